@@ -31,6 +31,7 @@ AM_DEVREG(21, NET_CONFIG,   RD, bool present);
 AM_DEVREG(22, NET_STATUS,   RD, int rx_len, tx_len);
 AM_DEVREG(23, NET_TX,       WR, Area buf);
 AM_DEVREG(24, NET_RX,       WR, Area buf);
+AM_DEVREG(25, PERF_COUNTER, RD, bool present; uint64_t cycle, instret, time, load, store, branch, branch_taken, trap);
 
 // Input
 
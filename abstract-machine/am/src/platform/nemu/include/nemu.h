@@ -32,9 +32,13 @@
 #define VGACTL_ADDR     (DEVICE_BASE + 0x0000100)
 #define AUDIO_ADDR      (DEVICE_BASE + 0x0000200)
 #define DISK_ADDR       (DEVICE_BASE + 0x0000300)
+#define GPU_ADDR        (DEVICE_BASE + 0x0000400)
+#define RTC_PAGE_ADDR   (MMIO_BASE   + 0x0001000)
 #define FB_ADDR         (MMIO_BASE   + 0x1000000)
 #define AUDIO_SBUF_ADDR (MMIO_BASE   + 0x1200000)
 #define AUDIO_SBUF_SIZE 0x10000
+#define CLINT_ADDR      (MMIO_BASE   + 0x2000000)
+#define PLIC_ADDR       (MMIO_BASE   + 0x4000000)
 
 extern char _pmem_start;
 #define PMEM_SIZE (128 * 1024 * 1024)
@@ -42,7 +46,10 @@ extern char _pmem_start;
 #define NEMU_PADDR_SPACE \
   RANGE(&_pmem_start, PMEM_END), \
   RANGE(FB_ADDR, FB_ADDR + 0x200000), \
-  RANGE(MMIO_BASE, MMIO_BASE + 0x1000) /* serial, rtc, screen, keyboard */
+  RANGE(MMIO_BASE, MMIO_BASE + 0x1000), /* serial, rtc, screen, keyboard */ \
+  RANGE(RTC_PAGE_ADDR, RTC_PAGE_ADDR + 0x1000), \
+  RANGE(CLINT_ADDR, CLINT_ADDR + 0x10000), \
+  RANGE(PLIC_ADDR, PLIC_ADDR + 0x202000)
 
 typedef uintptr_t PTE;
 
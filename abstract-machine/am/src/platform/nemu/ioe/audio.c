@@ -8,6 +8,8 @@
 #define AUDIO_SBUF_SIZE_ADDR (AUDIO_ADDR + 0x0c)
 #define AUDIO_INIT_ADDR      (AUDIO_ADDR + 0x10)
 #define AUDIO_COUNT_ADDR     (AUDIO_ADDR + 0x14)
+#define AUDIO_HEAD_ADDR      (AUDIO_ADDR + 0x18)
+#define AUDIO_TAIL_ADDR      (AUDIO_ADDR + 0x1c)
 
 static uint32_t bufsize = 0;
 void __am_audio_init() {
@@ -31,15 +33,24 @@ void __am_audio_status(AM_AUDIO_STATUS_T *stat) {
   stat->count = inl(AUDIO_COUNT_ADDR);
 }
 
+// The stream buffer is a ring, and head/tail are free-running byte counters.
+// Samples are written at tail in place, and published by updating tail.
 void __am_audio_play(AM_AUDIO_PLAY_T *ctl) {
-   uint32_t len = ctl->buf.end - ctl->buf.start;
-  volatile uint32_t left = bufsize - inl(AUDIO_COUNT_ADDR);
-  while (left < len) {
-    volatile uint32_t count = inl(AUDIO_COUNT_ADDR);
-    left = bufsize - count;
+  uint8_t *sbuf = (uint8_t *)AUDIO_SBUF_ADDR;
+  uint8_t *src = (uint8_t *)ctl->buf.start;
+  uint32_t len = ctl->buf.end - ctl->buf.start;
+  uint32_t tail = inl(AUDIO_TAIL_ADDR);
+  while (len > 0) {
+    uint32_t room = bufsize - (tail - inl(AUDIO_HEAD_ADDR));
+    if (room == 0) continue;
+    uint32_t n = (len < room ? len : room);
+    uint32_t idx = tail & (bufsize - 1);
+    uint32_t first = (n < bufsize - idx ? n : bufsize - idx);
+    memcpy(sbuf + idx, src, first);
+    memcpy(sbuf, src + first, n - first);
+    src += n;
+    len -= n;
+    tail += n;
+    outl(AUDIO_TAIL_ADDR, tail);
   }
-
-  uint8_t *dst = (uint8_t*)AUDIO_SBUF_ADDR;
-  uint8_t *src = (uint8_t*)ctl->buf.start;
-  memcpy(dst, src, len);
 }
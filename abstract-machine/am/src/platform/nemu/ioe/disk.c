@@ -1,12 +1,59 @@
 #include <am.h>
 #include <nemu.h>
 
+#define DISK_BLKSZ_ADDR     (DISK_ADDR + 0x00)
+#define DISK_BLKCNT_ADDR    (DISK_ADDR + 0x04)
+#define DISK_RING_BASE_ADDR (DISK_ADDR + 0x08)
+#define DISK_RING_SIZE_ADDR (DISK_ADDR + 0x0c)
+#define DISK_HEAD_ADDR      (DISK_ADDR + 0x10)
+#define DISK_TAIL_ADDR      (DISK_ADDR + 0x14)
+#define DISK_STATUS_ADDR    (DISK_ADDR + 0x18)
+
+#define DISK_PRESENT 1
+#define DISK_ERROR   2
+#define DISK_DONE    4
+#define NR_DESC 8
+
+// see nemu/src/device/disk.c
+typedef struct {
+  uint32_t cmd, blkno, blkcnt, buf;
+  volatile uint32_t status;
+} DiskDesc;
+
+static DiskDesc ring[NR_DESC];
+static uint32_t head = 0;
+static bool present = false;
+
+void __am_disk_init() {
+  present = inl(DISK_STATUS_ADDR) & DISK_PRESENT;
+  if (!present) return;
+  head = inl(DISK_TAIL_ADDR);
+  outl(DISK_RING_BASE_ADDR, (uintptr_t)ring);
+  outl(DISK_RING_SIZE_ADDR, NR_DESC);
+}
+
 void __am_disk_config(AM_DISK_CONFIG_T *cfg) {
-  cfg->present = false;
+  cfg->present = present;
+  cfg->blksz = present ? inl(DISK_BLKSZ_ADDR) : 0;
+  cfg->blkcnt = present ? inl(DISK_BLKCNT_ADDR) : 0;
 }
 
 void __am_disk_status(AM_DISK_STATUS_T *stat) {
+  stat->ready = present && inl(DISK_TAIL_ADDR) == head;
 }
 
 void __am_disk_blkio(AM_DISK_BLKIO_T *io) {
+  if (!present) return;
+  outl(DISK_STATUS_ADDR, DISK_DONE | DISK_ERROR);
+  DiskDesc *d = &ring[head % NR_DESC];
+  d->cmd = io->write;
+  d->blkno = io->blkno;
+  d->blkcnt = io->blkcnt;
+  d->buf = (uintptr_t)io->buf;
+  d->status = 0;
+  asm volatile ("" : : : "memory"); // the descriptor must be written before the doorbell
+  outl(DISK_HEAD_ADDR, ++ head);
+  // NEMU serves the request before the doorbell returns, but do not rely on it.
+  // A request which NEMU rejects without completing it sets ERROR only.
+  while (d->status == 0 && !(inl(DISK_STATUS_ADDR) & DISK_ERROR)) ;
 }
@@ -2,8 +2,33 @@
 #include <nemu.h>
 
 #define SYNC_ADDR (VGACTL_ADDR + 4)
+#define CAPS_ADDR (VGACTL_ADDR + 8)
+#define CAP_GPU   1
+
+// the 2D accelerator, see src/device/gpu.c of NEMU
+#define GPU_VMEMSZ_ADDR (GPU_ADDR + 0x00)
+#define GPU_STATUS_ADDR (GPU_ADDR + 0x04)
+#define GPU_SRC_ADDR    (GPU_ADDR + 0x08)
+#define GPU_DST_ADDR    (GPU_ADDR + 0x0c)
+#define GPU_SIZE_ADDR   (GPU_ADDR + 0x10)
+#define GPU_X_ADDR      (GPU_ADDR + 0x14)
+#define GPU_Y_ADDR      (GPU_ADDR + 0x18)
+#define GPU_W_ADDR      (GPU_ADDR + 0x1c)
+#define GPU_H_ADDR      (GPU_ADDR + 0x20)
+#define GPU_PITCH_ADDR  (GPU_ADDR + 0x24)
+#define GPU_CMD_ADDR    (GPU_ADDR + 0x2c)
+
+enum { GPU_CMD_COPY = 1, GPU_CMD_BLIT, GPU_CMD_FILL, GPU_CMD_RENDER };
+
+static void gpu_cmd(int cmd) {
+  asm volatile ("" : : : "memory"); // the device reads the data written before the command
+  outl(GPU_CMD_ADDR, cmd);
+}
+
+static bool has_accel = false;
 
 void __am_gpu_init() {
+  has_accel = inl(CAPS_ADDR) & CAP_GPU;
 }
 
 void __am_gpu_config(AM_GPU_CONFIG_T *cfg) {
@@ -11,23 +36,41 @@ void __am_gpu_config(AM_GPU_CONFIG_T *cfg) {
   uint32_t w = vga_wh >> 16;
   uint32_t h = vga_wh & 0xffff;
   *cfg = (AM_GPU_CONFIG_T) {
-    .present = true, .has_accel = false,
+    .present = true, .has_accel = has_accel,
     .width = w, .height = h,
-    .vmemsz = 0
+    .vmemsz = has_accel ? inl(GPU_VMEMSZ_ADDR) : 0
   };
 }
 
-void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *ctl) {
+// draw into the frame buffer directly when there is no accelerator
+static void fbdraw_direct(AM_GPU_FBDRAW_T *ctl) {
+  uint32_t vga_wh = inl(VGACTL_ADDR);
+  int W = vga_wh >> 16, H = vga_wh & 0xffff;
   int x = ctl->x, y = ctl->y, w = ctl->w, h = ctl->h;
-  if (!ctl->sync && (w == 0 || h == 0)) return;
+  if (x >= W || y >= H || x <= -w || y <= -h) return;
+  int x0 = (x < 0 ? 0 : x), x1 = (x > W - w ? W : x + w);
+  int y0 = (y < 0 ? 0 : y), y1 = (y > H - h ? H : y + h);
   uint32_t *pixels = ctl->pixels;
   uint32_t *dst = (uint32_t *)(uintptr_t)FB_ADDR;
-  uint32_t screen_w = inl(VGACTL_ADDR) >> 16;
-  for (int i = y; i < y+h; i ++) {
-    for (int j = x; j < x+w; j ++) {
-      dst[i * screen_w + j] = pixels[(i - y) * w + (j - x)];
+  for (int i = y0; i < y1; i ++) {
+    for (int j = x0; j < x1; j ++) {
+      dst[i * W + j] = pixels[(i - y) * w + (j - x)];
     }
   }
+}
+
+void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *ctl) {
+  if (ctl->w > 0 && ctl->h > 0 && !has_accel) {
+    fbdraw_direct(ctl);
+  } else if (ctl->w > 0 && ctl->h > 0) {
+    outl(GPU_SRC_ADDR, (uintptr_t)ctl->pixels);
+    outl(GPU_X_ADDR, ctl->x);
+    outl(GPU_Y_ADDR, ctl->y);
+    outl(GPU_W_ADDR, ctl->w);
+    outl(GPU_H_ADDR, ctl->h);
+    outl(GPU_PITCH_ADDR, 0);
+    gpu_cmd(GPU_CMD_BLIT);
+  }
   if (ctl->sync) {
     outl(SYNC_ADDR, 1);
   }
@@ -36,3 +79,17 @@ void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *ctl) {
 void __am_gpu_status(AM_GPU_STATUS_T *status) {
   status->ready = true;
 }
+
+void __am_gpu_memcpy(AM_GPU_MEMCPY_T *params) {
+  if (!has_accel) return;
+  outl(GPU_SRC_ADDR, (uintptr_t)params->src);
+  outl(GPU_DST_ADDR, params->dest);
+  outl(GPU_SIZE_ADDR, params->size);
+  gpu_cmd(GPU_CMD_COPY);
+}
+
+void __am_gpu_render(AM_GPU_RENDER_T *ren) {
+  if (!has_accel) return;
+  outl(GPU_SRC_ADDR, ren->root);
+  gpu_cmd(GPU_CMD_RENDER);
+}
@@ -4,12 +4,15 @@
 void __am_timer_init();
 void __am_gpu_init();
 void __am_audio_init();
+void __am_disk_init();
 void __am_input_keybrd(AM_INPUT_KEYBRD_T *);
 void __am_timer_rtc(AM_TIMER_RTC_T *);
 void __am_timer_uptime(AM_TIMER_UPTIME_T *);
 void __am_gpu_config(AM_GPU_CONFIG_T *);
 void __am_gpu_status(AM_GPU_STATUS_T *);
 void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *);
+void __am_gpu_memcpy(AM_GPU_MEMCPY_T *);
+void __am_gpu_render(AM_GPU_RENDER_T *);
 void __am_audio_config(AM_AUDIO_CONFIG_T *);
 void __am_audio_ctrl(AM_AUDIO_CTRL_T *);
 void __am_audio_status(AM_AUDIO_STATUS_T *);
@@ -17,10 +20,13 @@ void __am_audio_play(AM_AUDIO_PLAY_T *);
 void __am_disk_config(AM_DISK_CONFIG_T *cfg);
 void __am_disk_status(AM_DISK_STATUS_T *stat);
 void __am_disk_blkio(AM_DISK_BLKIO_T *io);
+void __am_perf_counter(AM_PERF_COUNTER_T *c);
+void __am_uart_config(AM_UART_CONFIG_T *cfg);
+void __am_uart_tx(AM_UART_TX_T *uart);
+void __am_uart_rx(AM_UART_RX_T *uart);
 
 static void __am_timer_config(AM_TIMER_CONFIG_T *cfg) { cfg->present = true; cfg->has_rtc = true; }
 static void __am_input_config(AM_INPUT_CONFIG_T *cfg) { cfg->present = true;  }
-static void __am_uart_config(AM_UART_CONFIG_T *cfg)   { cfg->present = false; }
 static void __am_net_config (AM_NET_CONFIG_T *cfg)    { cfg->present = false; }
 
 typedef void (*handler_t)(void *buf);
@@ -33,7 +39,11 @@ static void *lut[128] = {
   [AM_GPU_CONFIG  ] = __am_gpu_config,
   [AM_GPU_FBDRAW  ] = __am_gpu_fbdraw,
   [AM_GPU_STATUS  ] = __am_gpu_status,
+  [AM_GPU_MEMCPY  ] = __am_gpu_memcpy,
+  [AM_GPU_RENDER  ] = __am_gpu_render,
   [AM_UART_CONFIG ] = __am_uart_config,
+  [AM_UART_TX     ] = __am_uart_tx,
+  [AM_UART_RX     ] = __am_uart_rx,
   [AM_AUDIO_CONFIG] = __am_audio_config,
   [AM_AUDIO_CTRL  ] = __am_audio_ctrl,
   [AM_AUDIO_STATUS] = __am_audio_status,
@@ -42,6 +52,7 @@ static void *lut[128] = {
   [AM_DISK_STATUS ] = __am_disk_status,
   [AM_DISK_BLKIO  ] = __am_disk_blkio,
   [AM_NET_CONFIG  ] = __am_net_config,
+  [AM_PERF_COUNTER] = __am_perf_counter,
 };
 
 static void fail(void *buf) { panic("access nonexist register"); }
@@ -52,6 +63,7 @@ bool ioe_init() {
   __am_gpu_init();
   __am_timer_init();
   __am_audio_init();
+  __am_disk_init();
   return true;
 }
 
@@ -0,0 +1,35 @@
+#include <am.h>
+#include <nemu.h>
+
+#if defined(__riscv)
+// the events of hpmcounter3.. are assigned in nemu/src/isa/riscv32/system/csr.c
+#if __riscv_xlen == 32
+// read the high half again in case the low half wraps around in between
+#define read_counter(name) ({ \
+  uint32_t hi, lo, hi2; \
+  do { \
+    asm volatile ("csrr %0, " #name "h" : "=r"(hi)); \
+    asm volatile ("csrr %0, " #name : "=r"(lo)); \
+    asm volatile ("csrr %0, " #name "h" : "=r"(hi2)); \
+  } while (hi != hi2); \
+  ((uint64_t)hi << 32) | lo; })
+#else
+#define read_counter(name) ({ uint64_t v; asm volatile ("csrr %0, " #name : "=r"(v)); v; })
+#endif
+
+void __am_perf_counter(AM_PERF_COUNTER_T *c) {
+  c->present = true;
+  c->cycle = read_counter(cycle);
+  c->instret = read_counter(instret);
+  c->time = read_counter(time);
+  c->load = read_counter(hpmcounter3);
+  c->store = read_counter(hpmcounter4);
+  c->branch = read_counter(hpmcounter5);
+  c->branch_taken = read_counter(hpmcounter6);
+  c->trap = read_counter(hpmcounter7);
+}
+#else
+void __am_perf_counter(AM_PERF_COUNTER_T *c) {
+  c->present = false;
+}
+#endif
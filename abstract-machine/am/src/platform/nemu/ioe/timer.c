@@ -4,9 +4,14 @@
 void __am_timer_init() {
 }
 
+// read the timer page updated by NEMU with plain loads, see nemu/src/device/timer.c
 void __am_timer_uptime(AM_TIMER_UPTIME_T *uptime) {
-  uint32_t high = inl(RTC_ADDR + 4);
-  uint32_t low = inl(RTC_ADDR);
+  volatile uint32_t *page = (volatile uint32_t *)RTC_PAGE_ADDR;
+  uint32_t high, low;
+  do {
+    high = page[1];
+    low = page[0];
+  } while (high != page[1]);
   uptime->us = (uint64_t)low + ((uint64_t)high << 32);
 }
 
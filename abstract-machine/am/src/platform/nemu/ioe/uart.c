@@ -0,0 +1,18 @@
+#include <am.h>
+#include <nemu.h>
+
+#define SERIAL_LSR_ADDR (SERIAL_PORT + 5)
+#define LSR_DR 0x01
+
+void __am_uart_config(AM_UART_CONFIG_T *cfg) {
+  cfg->present = true;
+}
+
+void __am_uart_tx(AM_UART_TX_T *uart) {
+  outb(SERIAL_PORT, uart->data);
+}
+
+// NEMU only has input with CONFIG_SERIAL_INPUT_FIFO, otherwise LSR is never ready
+void __am_uart_rx(AM_UART_RX_T *uart) {
+  uart->data = (inb(SERIAL_LSR_ADDR) & LSR_DR) ? inb(SERIAL_PORT) : -1;
+}
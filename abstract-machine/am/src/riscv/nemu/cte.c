@@ -1,13 +1,57 @@
 #include <am.h>
+#include <nemu.h>
 #include <riscv/riscv.h>
 #include <klib.h>
 
+#define INTR_BIT    ((uintptr_t)1 << (__riscv_xlen - 1))
+#define IRQ_M_TIMER 7
+#define IRQ_M_EXT   11
+#define MSTATUS_MIE 0x8
+
+#define CLINT_MTIMECMP (CLINT_ADDR + 0x4000)
+#define CLINT_MTIME    (CLINT_ADDR + 0xbff8)
+#define PLIC_PRIORITY  (PLIC_ADDR + 0x0)
+#define PLIC_ENABLE    (PLIC_ADDR + 0x2000)
+#define PLIC_CLAIM     (PLIC_ADDR + 0x200004)  // of context 0, the M-mode
+
+// the PLIC sources of NEMU, see include/device/intr.h there
+#define IRQ_DISK   1
+#define IRQ_SERIAL 2
+
+// mtime counts guest instructions in NEMU
+#define TIMER_INTERVAL 100000
+
 static Context* (*user_handler)(Event, Context*) = NULL;
 
+static void set_timer() {
+  uint32_t hi, lo;
+  do {
+    hi = inl(CLINT_MTIME + 4);
+    lo = inl(CLINT_MTIME);
+  } while (hi != inl(CLINT_MTIME + 4));
+  uint64_t cmp = ((uint64_t)hi << 32 | lo) + TIMER_INTERVAL;
+  // mtimecmp never goes below the deadline while it is written in halves
+  outl(CLINT_MTIMECMP + 4, -1);
+  outl(CLINT_MTIMECMP, (uint32_t)cmp);
+  outl(CLINT_MTIMECMP + 4, cmp >> 32);
+}
+
 Context* __am_irq_handle(Context *c) {
   if (user_handler) {
     Event ev = {0};
-    switch (c->mcause) {
+    if (c->mcause & INTR_BIT) {
+      switch (c->mcause & ~INTR_BIT) {
+        case IRQ_M_TIMER: set_timer(); ev.event = EVENT_IRQ_TIMER; break;
+        case IRQ_M_EXT: {
+          // the source is pending again if its device still asserts the line
+          uint32_t src = inl(PLIC_CLAIM);
+          outl(PLIC_CLAIM, src);
+          ev.event = EVENT_IRQ_IODEV;
+          break;
+        }
+        default: ev.event = EVENT_ERROR; break;
+      }
+    } else switch (c->mcause) {
       case 11:
         if (c->gpr[17] == -1) {
           ev.event = EVENT_YIELD;
@@ -41,6 +85,21 @@ bool cte_init(Context*(*handler)(Event, Context*)) {
     ::: "t0"
   );
 
+  // let the timer and the devices interrupt, once iset() enables it,
+  // and leave out the controllers which NEMU is built without
+  uintptr_t mie = 0;
+  if (NEMU_CLINT) {
+    set_timer();
+    mie |= 1 << IRQ_M_TIMER;
+  }
+  if (NEMU_PLIC) {
+    outl(PLIC_PRIORITY + 4 * IRQ_DISK, 1);
+    outl(PLIC_PRIORITY + 4 * IRQ_SERIAL, 1);
+    outl(PLIC_ENABLE, (1 << IRQ_DISK) | (1 << IRQ_SERIAL));
+    mie |= 1 << IRQ_M_EXT;
+  }
+  asm volatile("csrw mie, %0" : : "r"(mie));
+
   // register event handler
   user_handler = handler;
 
@@ -60,8 +119,12 @@ void yield() {
 }
 
 bool ienabled() {
-  return false;
+  uintptr_t mstatus;
+  asm volatile("csrr %0, mstatus" : "=r"(mstatus));
+  return mstatus & MSTATUS_MIE;
 }
 
 void iset(bool enable) {
+  if (enable) asm volatile("csrs mstatus, %0" : : "r"(MSTATUS_MIE));
+  else asm volatile("csrc mstatus, %0" : : "r"(MSTATUS_MIE));
 }
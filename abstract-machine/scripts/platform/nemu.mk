@@ -5,6 +5,8 @@ AM_SRCS := platform/nemu/trm.c \
            platform/nemu/ioe/gpu.c \
            platform/nemu/ioe/audio.c \
            platform/nemu/ioe/disk.c \
+           platform/nemu/ioe/perf.c \
+           platform/nemu/ioe/uart.c \
            platform/nemu/mpe.c
 
 CFLAGS    += -fdata-sections -ffunction-sections
@@ -16,6 +18,12 @@ NEMUFLAGS += -l $(shell dirname $(IMAGE).elf)/nemu-log.txt
 NEMUFLAGS += -e $(IMAGE).elf
 NEMUFLAGS += -b
 
+# the interrupt controllers of riscv NEMU, set them to 0 when NEMU is built
+# without DEVICE, HAS_CLINT or HAS_PLIC, e.g. `make NEMU_PLIC=0 run'
+NEMU_CLINT ?= 1
+NEMU_PLIC  ?= 1
+CFLAGS += -DNEMU_CLINT=$(NEMU_CLINT) -DNEMU_PLIC=$(NEMU_PLIC)
+
 MAINARGS_MAX_LEN = 64
 MAINARGS_PLACEHOLDER = The insert-arg rule in Makefile will insert mainargs here.
 CFLAGS += -DMAINARGS_MAX_LEN=$(MAINARGS_MAX_LEN) -DMAINARGS_PLACEHOLDER=\""$(MAINARGS_PLACEHOLDER)"\"
@@ -87,10 +87,22 @@ finish:
 
 
 // --- pattern matching wrappers for decode ---
+#ifdef CONFIG_PERF_COUNTER
+// each INSTPAT registers its counter on the first match and caches it
+#define INSTPAT_PERF(name, ...) do { \
+  static uint64_t *__perf_cnt = NULL; \
+  if (unlikely(__perf_cnt == NULL)) __perf_cnt = perf_inst_counter(str(name)); \
+  (*__perf_cnt) ++; \
+} while (0)
+#else
+#define INSTPAT_PERF(name, ...)
+#endif
+
 #define INSTPAT(pattern, ...) do { \
   uint64_t key, mask, shift; \
   pattern_decode(pattern, STRLEN(pattern), &key, &mask, &shift); \
   if ((((uint64_t)INSTPAT_INST(s) >> shift) & mask) == key) { \
+    INSTPAT_PERF(__VA_ARGS__); \
     INSTPAT_MATCH(s, ##__VA_ARGS__); \
     goto *(__instpat_end); \
   } \
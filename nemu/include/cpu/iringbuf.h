@@ -0,0 +1,72 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_IRINGBUF_H__
+#define __CPU_IRINGBUF_H__
+
+#include <cpu/decode.h>
+
+#ifdef CONFIG_IRINGBUF
+
+/* The instruction history ring records every executed instruction. It is
+ * indexed by the number of guest instructions executed so far, so pushing
+ * an entry costs three stores and a mask.
+ */
+
+#define IRINGBUF_NR_ENTRY (1ull << CONFIG_IRINGBUF_SHIFT)
+#define IRINGBUF_MASK (IRINGBUF_NR_ENTRY - 1)
+
+typedef struct {
+  word_t pc;
+  word_t dnpc;
+  uint32_t inst;  // the first 4 bytes for ISAs with variable-length instructions
+} IRingEntry;
+
+/* The dump file starts with this header, followed by `nr_entry' entries
+ * of `entry_size' bytes from the oldest to the newest. All fields are in
+ * the byte order of the host. See tools/iringbuf-decode.
+ */
+#define IRINGBUF_MAGIC "NEMUIRB"
+#define IRINGBUF_VERSION 1
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t word_size;   // sizeof(word_t)
+  uint32_t entry_size;  // sizeof(IRingEntry)
+  uint32_t state;       // nemu_state.state
+  uint64_t nr_inst;     // total guest instructions executed
+  uint64_t nr_entry;
+  uint64_t cur_pc;      // the instruction being executed, if it failed halfway
+  char isa[16];
+} IRingHeader;
+
+extern IRingEntry g_iringbuf[];
+extern uint64_t g_nr_guest_inst;
+
+static inline void iringbuf_push(Decode *s) {
+  IRingEntry *e = &g_iringbuf[g_nr_guest_inst & IRINGBUF_MASK];
+  e->pc = s->pc;
+  e->dnpc = s->dnpc;
+  memcpy(&e->inst, &s->isa.inst, sizeof(e->inst));
+}
+
+void iringbuf_set_dump_file(char *file);
+void iringbuf_display();
+void iringbuf_dump();
+
+#endif
+
+#endif
@@ -20,5 +20,7 @@
 
 typedef void (*alarm_handler_t) ();
 void add_alarm_handle(alarm_handler_t h);
+// called by the other threads of NEMU, the alarm belongs to the CPU thread
+void alarm_block_this_thread();
 
 #endif
@@ -0,0 +1,43 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_INTR_H__
+#define __DEVICE_INTR_H__
+
+#include <common.h>
+
+// interrupt sources of the devices, as numbered at the PLIC
+enum {
+  IRQ_NONE = 0,
+  IRQ_DISK,
+  IRQ_SERIAL,
+  IRQ_KEYBOARD,
+  NR_IRQ
+};
+
+/* Devices drive their interrupt lines by level. A device sets the level
+ * whenever its state which the line depends on changes, and the line
+ * stays asserted until the guest services the device.
+ */
+void dev_set_irq(int irq, bool level);
+
+// the lines from the interrupt controllers to the hart
+bool clint_mtip();
+bool clint_msip();
+uint64_t clint_mtime();
+bool plic_eip(int ctx);
+void plic_set_irq(int irq, bool level);
+
+#endif
@@ -28,6 +28,9 @@ typedef struct {
   paddr_t high;
   void *space;
   io_callback_t callback;
+#ifdef CONFIG_PERF_COUNTER
+  uint64_t *perf; // number of reads and writes
+#endif
 } IOMap;
 
 static inline bool map_inside(IOMap *map, paddr_t addr) {
@@ -32,6 +32,8 @@ void init_isa();
 extern CPU_state cpu;
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
+int isa_reg_str2id(const char *name);  // -1 if there is no such register
+word_t isa_reg_id2val(int id);
 
 // exec
 struct Decode;
@@ -31,7 +31,23 @@ static inline bool in_pmem(paddr_t addr) {
   return addr - CONFIG_MBASE < CONFIG_MSIZE;
 }
 
+static inline bool in_pmem_range(paddr_t addr, uint64_t len) {
+  return in_pmem(addr) && (addr - CONFIG_MBASE) + len <= CONFIG_MSIZE;
+}
+
+/* A device calls this after its DMA writes pmem, since the reference of
+ * DiffTest does not have the device and does not see the change.
+ */
+void pmem_dma_sync(paddr_t addr, size_t len);
+
+#define MEM_WATCH_PAGE_SHIFT 12
+/* number of memory watchpoints on each page of pmem, checked by paddr_write() */
+extern uint8_t g_mem_watch_page[];
+void mem_watch_hit(paddr_t addr, int len);
+
 word_t paddr_read(paddr_t addr, int len);
+word_t paddr_ifetch(paddr_t addr, int len);
+word_t paddr_peek(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 
 #endif
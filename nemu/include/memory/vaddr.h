@@ -20,6 +20,7 @@
 
 word_t vaddr_ifetch(vaddr_t addr, int len);
 word_t vaddr_read(vaddr_t addr, int len);
+word_t vaddr_peek(vaddr_t addr, int len);
 void vaddr_write(vaddr_t addr, int len, word_t data);
 
 #define PAGE_SHIFT        12
@@ -34,6 +34,63 @@ extern NEMUState nemu_state;
 
 uint64_t get_time();
 
+// ----------- trigger -----------
+
+#ifdef CONFIG_TRACE_TRIGGER
+extern bool g_trigger_pc_armed;
+extern bool g_trigger_mmio_armed;
+extern bool g_trigger_ecall_armed;
+void trigger_check_pc(vaddr_t pc);
+void trigger_check_mmio(const char *name);
+void trigger_check_ecall(word_t no);
+bool trigger_configured();
+bool trigger_trace_on();
+bool trigger_add(const char *spec);
+void trigger_display();
+#endif
+
+// ----------- profiler -----------
+
+#ifdef CONFIG_PROFILER
+#include <signal.h>
+extern volatile sig_atomic_t g_prof_countdown;
+extern vaddr_t g_prof_block;
+void profiler_sample(vaddr_t pc);
+bool profiler_set_interval(const char *spec);
+void profiler_report();
+#endif
+
+// ----------- perf -----------
+
+#ifdef CONFIG_PERF_COUNTER
+typedef struct {
+  uint64_t load, store;
+  uint64_t branch_taken, branch_untaken;
+  uint64_t device_update, device_sync;
+  uint64_t trap;  // exceptions and interrupts
+} PerfStat;
+
+extern PerfStat g_perf;
+uint64_t *perf_inst_counter(const char *name);
+uint64_t *perf_map_counter(const char *name);
+void perf_intr(word_t NO);
+void perf_display();
+void perf_set_json_file(char *file);
+void perf_dump_json(uint64_t host_time);
+#define PERF_INC(field) (g_perf.field ++)
+#else
+#define PERF_INC(field) ((void)0)
+#endif
+
+// ----------- uarch -----------
+
+#ifdef CONFIG_UARCH_SIM
+void uarch_icache_access(paddr_t addr, int len);
+void uarch_dcache_access(paddr_t addr, int len, bool is_write);
+void uarch_branch(vaddr_t pc, bool taken);
+void uarch_report();
+#endif
+
 // ----------- log -----------
 
 #define ANSI_FG_BLACK   "\33[1;30m"
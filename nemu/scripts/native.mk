@@ -24,7 +24,7 @@ $(BINARY):: compile_git
 
 # Some convenient rules
 
-override ARGS ?= --log=$(BUILD_DIR)/nemu-log.txt
+override ARGS ?= --log=$(BUILD_DIR)/nemu-log.txt --ring=$(BUILD_DIR)/nemu-iringbuf.bin
 override ARGS += $(ARGS_DIFF)
 
 # Command to execute NEMU
@@ -41,10 +41,33 @@ gdb: run-env
 	$(call git_commit, "gdb NEMU")
 	gdb -s $(BINARY) --args $(NEMU_EXEC)
 
+# Run IMAGES in batch mode in parallel, e.g.
+#   make batch IMAGES="$(wildcard path/to/cputest/build/*.bin)" BATCH_ARGS="-t 30 --junit report.xml"
+IMAGES ?=
+BATCH_ARGS ?=
+batch: run-env
+	$(call git_commit, "batch NEMU")
+	python3 $(NEMU_HOME)/tools/batch-run.py --nemu $(BINARY) --nemu-args "$(ARGS_DIFF)" \
+	  -o $(BUILD_DIR)/batch $(BATCH_ARGS) $(IMAGES)
+
 clean-tools = $(dir $(shell find ./tools -maxdepth 2 -mindepth 2 -name "Makefile"))
 $(clean-tools):
 	-@$(MAKE) -s -C $@ clean
 clean-tools: $(clean-tools)
 clean-all: clean distclean clean-tools
 
-.PHONY: run gdb run-env clean-tools clean-all $(clean-tools)
+# Run the benchmark suite and compare it against the stored baseline.
+# Build NEMU with `make $(GUEST_ISA)-bench_defconfig' first, or bench.py refuses to run
+# unless BENCH_ARGS=--force.
+BENCH_THRESHOLD ?= 5
+BENCH_ARGS ?=
+BENCH_EXEC := python3 $(NEMU_HOME)/tools/bench.py --nemu $(BINARY) --arch $(GUEST_ISA)-nemu \
+  --threshold $(BENCH_THRESHOLD) $(BENCH_ARGS)
+
+bench: $(BINARY)
+	$(BENCH_EXEC)
+
+bench-baseline: $(BINARY)
+	$(BENCH_EXEC) --save-baseline
+
+.PHONY: run gdb batch bench bench-baseline run-env clean-tools clean-all $(clean-tools)
@@ -16,6 +16,7 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <cpu/iringbuf.h>
 #include <locale.h>
 
 /* The assembly code of instructions executed is only output to the screen
@@ -28,12 +29,18 @@
 CPU_state cpu = {};
 uint64_t g_nr_guest_inst = 0;
 static uint64_t g_timer = 0; // unit: us
+static uint64_t g_max_inst = -1;
 static bool g_print_step = false;
 
 void device_update();
+void device_flush();
 
 
 void difftest_wp();
+#ifdef CONFIG_BREAKPOINT
+extern int g_nr_breakpoint;
+bool breakpoint_check(vaddr_t pc);
+#endif
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
 #ifdef CONFIG_ITRACE_COND
   if (ITRACE_COND) { log_write("%s\n", _this->logbuf); }
@@ -77,11 +84,28 @@ static void exec_once(Decode *s, vaddr_t pc) {
 static void execute(uint64_t n) {
   Decode s;
   for (;n > 0; n --) {
+    IFDEF(CONFIG_TRACE_TRIGGER, if (unlikely(g_trigger_pc_armed)) trigger_check_pc(cpu.pc));
+#ifdef CONFIG_BREAKPOINT
+    if (unlikely(g_nr_breakpoint > 0) && breakpoint_check(cpu.pc)) {
+      nemu_state.state = NEMU_STOP;
+      break;
+    }
+#endif
     exec_once(&s, cpu.pc);
+    IFDEF(CONFIG_IRINGBUF, iringbuf_push(&s));
     g_nr_guest_inst ++;
+#ifdef CONFIG_PROFILER
+    if (unlikely(-- g_prof_countdown == 0)) profiler_sample(s.pc);
+    if (s.dnpc != s.snpc) g_prof_block = s.dnpc;
+#endif
     trace_and_difftest(&s, cpu.pc);
     if (nemu_state.state != NEMU_RUNNING) break;
     IFDEF(CONFIG_DEVICE, device_update());
+    word_t intr = isa_query_intr();
+    if (unlikely(intr != INTR_EMPTY)) {
+      cpu.pc = isa_raise_intr(intr, cpu.pc);
+      IFDEF(CONFIG_DIFFTEST, ref_difftest_raise_intr(intr));
+    }
   }
 }
 
@@ -92,15 +116,27 @@ static void statistic() {
   Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
   if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+  IFDEF(CONFIG_FTRACE, void ftrace_report(); ftrace_report());
+  IFDEF(CONFIG_PROFILER, profiler_report());
+  IFDEF(CONFIG_UARCH_SIM, uarch_report());
+  IFDEF(CONFIG_PERF_COUNTER, perf_dump_json(g_timer));
 }
 
 void assert_fail_msg() {
-  void iringbuf_display();
-  iringbuf_display();
+  IFDEF(CONFIG_DEVICE, device_flush());
+  IFDEF(CONFIG_IRINGBUF, iringbuf_display());
+  IFDEF(CONFIG_IRINGBUF, iringbuf_dump());
   isa_reg_display();
   statistic();
 }
 
+/* Abort the guest after it executes `n' instructions in total. This bounds
+ * the running time of a test in batch mode.
+ */
+void cpu_set_max_inst(uint64_t n) {
+  g_max_inst = n;
+}
+
 /* Simulate how the CPU works. */
 void cpu_exec(uint64_t n) {
   g_print_step = (n < MAX_INST_TO_PRINT);
@@ -113,11 +149,19 @@ void cpu_exec(uint64_t n) {
 
   uint64_t timer_start = get_time();
 
-  execute(n);
+  uint64_t remain = g_max_inst - g_nr_guest_inst;
+  execute(n < remain ? n : remain);
+  // let the output of the guest appear before the messages of NEMU
+  IFDEF(CONFIG_DEVICE, device_flush());
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
 
+  if (nemu_state.state == NEMU_RUNNING && g_nr_guest_inst >= g_max_inst) {
+    Log("nemu: instruction limit %" PRIu64 " is reached", g_max_inst);
+    set_nemu_state(NEMU_ABORT, cpu.pc, -1);
+  }
+
   switch (nemu_state.state) {
     case NEMU_RUNNING: nemu_state.state = NEMU_STOP; break;
 
@@ -127,6 +171,7 @@ void cpu_exec(uint64_t n) {
            (nemu_state.halt_ret == 0 ? ANSI_FMT("HIT GOOD TRAP", ANSI_FG_GREEN) :
             ANSI_FMT("HIT BAD TRAP", ANSI_FG_RED))),
           nemu_state.halt_pc);
+      if (nemu_state.state == NEMU_ABORT) IFDEF(CONFIG_IRINGBUF, iringbuf_dump());
       // fall through
     case NEMU_QUIT: statistic();
   }
@@ -1,57 +1,73 @@
-#include <common.h>
-#include <memory/vaddr.h>
-
-#define IRINGBUF_SIZE 9
-
-struct iringbuf_node {
-    word_t pc;
-    word_t inst;
-};
-
-struct iringbuf {
-    int next;
-    bool full;
-    struct iringbuf_node nodes[IRINGBUF_SIZE];
-} iringbuf = {
-    .next = 0,
-    .full = false,
-};
-
-void iringbuf_push(word_t pc, word_t inst) {
-    iringbuf.nodes[iringbuf.next].pc = pc;
-    iringbuf.nodes[iringbuf.next].inst = inst;
-    iringbuf.next = (iringbuf.next + 1) % IRINGBUF_SIZE;
-    if (!iringbuf.full && iringbuf.next == 0) iringbuf.full = true;
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/iringbuf.h>
+
+#define NR_DISPLAY 16
+
+IRingEntry g_iringbuf[IRINGBUF_NR_ENTRY] = {};
+static char *dump_file = "nemu-iringbuf.bin";
+
+static inline uint64_t iringbuf_nr_valid() {
+  return g_nr_guest_inst < IRINGBUF_NR_ENTRY ? g_nr_guest_inst : IRINGBUF_NR_ENTRY;
+}
+
+void iringbuf_set_dump_file(char *file) {
+  dump_file = file;
 }
 
 void iringbuf_display() {
-    if (!iringbuf.full && iringbuf.next == 0) return; // empty
+  uint64_t n = iringbuf_nr_valid();
+  if (n > NR_DISPLAY) n = NR_DISPLAY;
+  char buf[128];
+  for (uint64_t i = g_nr_guest_inst - n; i < g_nr_guest_inst; i ++) {
+    IRingEntry *e = &g_iringbuf[i & IRINGBUF_MASK];
+    char *p = buf;
+    p += snprintf(p, sizeof(buf), "     " FMT_WORD ": %08" PRIx32 " ", e->pc, e->inst);
 #ifdef CONFIG_ITRACE
     void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
+    disassemble(p, buf + sizeof(buf) - p, e->pc, (uint8_t *)&e->inst, sizeof(e->inst));
+#endif
+    puts(buf);
+  }
+  printf(" --> " FMT_WORD "\n", cpu.pc);
+}
 
-    char buf[128];  // line buffer
-    char *p;
-
-    // print previous and current
-    int i = iringbuf.full?iringbuf.next:0;
-    int end = iringbuf.next;    // not included
-    do {
-        p = buf;
-        p += sprintf(p, "%s" FMT_WORD ": ", (i+1)%IRINGBUF_SIZE==end?" --> ":"     ", iringbuf.nodes[i].pc);
-        disassemble(p, buf+sizeof(buf)-p, iringbuf.nodes[i].pc, (uint8_t *)&iringbuf.nodes[i].inst, 4);
-        puts(buf);
-        i = (i + 1) % IRINGBUF_SIZE;
-    } while (i != end);
-
-    // print next 8 insts
-    int current = iringbuf.nodes[(IRINGBUF_SIZE+iringbuf.next-1)%IRINGBUF_SIZE].pc;
-    for (i = 1; i <= 8; i ++) {
-        p = buf;
-        word_t inst_addr = current + i * sizeof(word_t);
-        word_t inst = vaddr_ifetch(inst_addr, sizeof(word_t));
-        p += sprintf(p, "     " FMT_WORD ": ", inst_addr);
-        disassemble(p, buf+sizeof(buf)-p, inst_addr, (uint8_t *)&inst, 4);
-        puts(buf);
-    }
+void iringbuf_dump() {
+#ifndef CONFIG_TARGET_AM
+  uint64_t n = iringbuf_nr_valid();
+  FILE *fp = fopen(dump_file, "wb");
+  if (fp == NULL) {
+    Log("Can not open '%s' to dump the instruction history", dump_file);
+    return;
+  }
+
+  IRingHeader h = {
+    .magic = IRINGBUF_MAGIC, .version = IRINGBUF_VERSION,
+    .word_size = sizeof(word_t), .entry_size = sizeof(IRingEntry),
+    .state = nemu_state.state, .nr_inst = g_nr_guest_inst, .nr_entry = n,
+    .cur_pc = cpu.pc, .isa = str(__GUEST_ISA__),
+  };
+  // the oldest entry is at the current index once the ring has wrapped
+  uint64_t start = (g_nr_guest_inst - n) & IRINGBUF_MASK;
+  uint64_t first = (n < IRINGBUF_NR_ENTRY - start ? n : IRINGBUF_NR_ENTRY - start);
+  bool ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+    fwrite(&g_iringbuf[start], sizeof(IRingEntry), first, fp) == first &&
+    fwrite(&g_iringbuf[0], sizeof(IRingEntry), n - first, fp) == n - first;
+  fclose(fp);
+  if (ok) Log("The last %" PRIu64 " instructions are dumped to '%s'", n, dump_file);
+  else Log("Fail to dump the instruction history to '%s'", dump_file);
 #endif
-}
\ No newline at end of file
+}
@@ -35,6 +35,13 @@ static void alarm_sig_handler(int signum) {
   }
 }
 
+void alarm_block_this_thread() {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGVTALRM);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+}
+
 void init_alarm() {
   struct sigaction s;
   memset(&s, 0, sizeof(s));
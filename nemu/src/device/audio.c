@@ -16,6 +16,7 @@
 #include <common.h>
 #include <device/map.h>
 #include <SDL2/SDL.h>
+#include <stdatomic.h>
 
 enum {
   reg_freq,
@@ -24,65 +25,174 @@ enum {
   reg_sbuf_size,
   reg_init,
   reg_count,
+  reg_head,
+  reg_tail,
   nr_reg
 };
 
+/* The stream buffer is a ring shared with the guest. `head' and `tail' are
+ * free-running byte counters, and the index into the ring is the counter
+ * modulo CONFIG_SB_SIZE. The guest is the only producer: it writes samples
+ * at `tail' in place, then publishes them by writing reg_tail. The SDL audio
+ * thread is the only consumer and advances `head'. No lock is needed, and
+ * both sides copy at most two segments with memcpy().
+ */
+static_assert((CONFIG_SB_SIZE & (CONFIG_SB_SIZE - 1)) == 0, "CONFIG_SB_SIZE must be a power of 2");
+#define SB_MASK (CONFIG_SB_SIZE - 1)
+
 static uint8_t *sbuf = NULL;
-static uint8_t audio_buffer[CONFIG_SB_SIZE];
-static uint32_t buf_count = 0;
-static uint32_t buf_head = 0;
-static uint32_t buf_tail = 0;
 static uint32_t *audio_base = NULL;
-static size_t sbuf_count = 0;
+static atomic_uint sb_head = 0, sb_tail = 0;
 
-static inline void set_buf_count(uint32_t c) {
-  buf_count = c;
-  audio_base[reg_count] = buf_count;
+// copy `len' bytes out of the ring from `head', and return the new head
+static uint32_t sbuf_consume(uint32_t head, uint8_t *dst, uint32_t len) {
+  uint32_t idx = head & SB_MASK;
+  uint32_t first = (len < CONFIG_SB_SIZE - idx ? len : CONFIG_SB_SIZE - idx);
+  memcpy(dst, sbuf + idx, first);
+  memcpy(dst + first, sbuf, len - first);
+  return head + len;
 }
 
 static void audio_callback(void *userdata, uint8_t *stream, int len) {
-  int i = 0;
-  for (; i < len && i < buf_count; i++) {
-    stream[i] = audio_buffer[buf_head];
-    buf_head = (buf_head + 1) % CONFIG_SB_SIZE;
-  }
-  set_buf_count(buf_count - i);
-  sbuf_count += i;
-  for (; i < len; i++) {
-    stream[i] = 0;
+  uint32_t head = atomic_load_explicit(&sb_head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&sb_tail, memory_order_acquire);
+  uint32_t n = (tail - head < (uint32_t)len ? tail - head : len);
+  head = sbuf_consume(head, stream, n);
+  atomic_store_explicit(&sb_head, head, memory_order_release);
+  memset(stream + n, 0, len - n);
+}
+
+/* With --audio=FILE, the stream is written to a WAV file instead of being
+ * played by SDL. The ring is drained whenever the guest publishes samples,
+ * so the guest runs at full speed. The sizes in the header are patched at exit,
+ * and stay 0xffffffff (streaming) if NEMU is killed. If the guest changes the
+ * format after samples are written, the file is finished and the rest of the
+ * stream goes to FILE.1, FILE.2, and so on.
+ */
+static char *wav_file = NULL;
+static char wav_name[256] = "";
+static FILE *wav_fp = NULL;
+static uint32_t wav_size = 0;
+static int wav_freq = 0, wav_channels = 0, wav_nr_file = 0;
+
+void audio_set_wav_file(char *file) {
+  wav_file = file;
+}
+
+static void wav_write_header(uint32_t data_size) {
+  int freq = wav_freq, channels = wav_channels;
+  struct {
+    char riff[4]; uint32_t riff_size; char wave[4];
+    char fmt[4]; uint32_t fmt_size; uint16_t format, channels;
+    uint32_t freq, byte_rate; uint16_t block_align, bits;
+    char data[4]; uint32_t data_size;
+  } __attribute__((packed)) h = {
+    .riff = "RIFF", .riff_size = data_size == -1 ? -1 : 36 + data_size, .wave = "WAVE",
+    .fmt = "fmt ", .fmt_size = 16, .format = 1, .channels = channels,
+    .freq = freq, .byte_rate = freq * channels * 2, .block_align = channels * 2, .bits = 16,
+    .data = "data", .data_size = data_size,
+  };
+  fseek(wav_fp, 0, SEEK_SET);
+  fwrite(&h, sizeof(h), 1, wav_fp);
+  fseek(wav_fp, 0, SEEK_END);
+}
+
+static void wav_close() {
+  wav_write_header(wav_size);
+  fclose(wav_fp);
+  wav_fp = NULL;
+  Log("%u bytes of audio (%d Hz, %d channel(s)) are written to '%s'",
+      wav_size, wav_freq, wav_channels, wav_name);
+}
+
+static void wav_drain() {
+  uint32_t head = atomic_load_explicit(&sb_head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&sb_tail, memory_order_relaxed);
+  uint32_t idx = head & SB_MASK, len = tail - head;
+  uint32_t first = (len < CONFIG_SB_SIZE - idx ? len : CONFIG_SB_SIZE - idx);
+  fwrite(sbuf + idx, 1, first, wav_fp);
+  fwrite(sbuf, 1, len - first, wav_fp);
+  wav_size += len;
+  atomic_store_explicit(&sb_head, tail, memory_order_relaxed);
+}
+
+static void wav_exit() {
+  if (wav_fp != NULL) wav_close();
+}
+
+static void init_wav() {
+  int freq = audio_base[reg_freq], channels = audio_base[reg_channels];
+  if (wav_fp != NULL) {
+    if (freq == wav_freq && channels == wav_channels) return;
+    if (wav_size == 0) {
+      // nothing is written yet, so just fix the format in the header
+      wav_freq = freq;
+      wav_channels = channels;
+      wav_write_header(-1);
+      return;
+    }
+    wav_close();
+  } else {
+    atexit(wav_exit);
   }
+
+  if (wav_nr_file == 0) snprintf(wav_name, sizeof(wav_name), "%s", wav_file);
+  else snprintf(wav_name, sizeof(wav_name), "%s.%d", wav_file, wav_nr_file);
+  wav_nr_file ++;
+  wav_fp = fopen(wav_name, "wb");
+  Assert(wav_fp, "Can not open '%s'", wav_name);
+  wav_freq = freq;
+  wav_channels = channels;
+  wav_size = 0;
+  wav_write_header(-1);
+}
+
+static void init_sdl_audio() {
+  SDL_AudioSpec s = {};
+  s.format = AUDIO_S16SYS;  // 假设系统中音频数据的格式总是使用16位有符号数来表示
+  s.userdata = NULL;        // 不使用
+  s.freq = *(audio_base + reg_freq);
+  s.channels = *(audio_base + reg_channels);
+  s.samples = *(audio_base + reg_samples);
+  s.callback = audio_callback;
+  SDL_InitSubSystem(SDL_INIT_AUDIO);
+  SDL_OpenAudio(&s, NULL);
+  SDL_PauseAudio(0);
 }
 
-static SDL_AudioSpec s = {};
 static void audio_io_handler(uint32_t offset, int len, bool is_write) {
   int reg = offset / 4;
   assert(reg < nr_reg);
-  if (is_write) {
-    assert(reg != reg_sbuf_size);
-    if (reg == reg_init) {
-      s.format = AUDIO_S16SYS;  // 假设系统中音频数据的格式总是使用16位有符号数来表示
-      s.userdata = NULL;        // 不使用
-      s.freq = *(audio_base + reg_freq);
-      s.channels = *(audio_base + reg_channels);
-      s.samples = *(audio_base + reg_samples);
-      s.callback = audio_callback;
-      SDL_InitSubSystem(SDL_INIT_AUDIO);
-      SDL_OpenAudio(&s, NULL);
-      SDL_PauseAudio(0);
-    }
+  if (!is_write) {
+    uint32_t head = atomic_load_explicit(&sb_head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&sb_tail, memory_order_relaxed);
+    audio_base[reg_head] = head;
+    audio_base[reg_tail] = tail;
+    audio_base[reg_count] = tail - head;
+    return;
   }
-}
 
-static void audio_sbuf_handler(uint32_t offset, int len, bool is_write) {
-  assert(is_write == 1);
-  assert(CONFIG_SB_SIZE - buf_count >= len);
-  SDL_LockAudio();
-  for (int i = 0; i < len; i++) {
-    audio_buffer[buf_tail] = sbuf[offset+i];
-    buf_tail = (buf_tail + 1) % CONFIG_SB_SIZE;
+  switch (reg) {
+    case reg_freq: case reg_channels: case reg_samples: break;
+    case reg_init:
+      // the audio thread may still be running if the guest initializes again
+      SDL_LockAudio();
+      atomic_store(&sb_head, 0);
+      atomic_store(&sb_tail, 0);
+      SDL_UnlockAudio();
+      if (wav_file != NULL) init_wav();
+      else init_sdl_audio();
+      break;
+    case reg_tail: {
+      uint32_t tail = audio_base[reg_tail];
+      uint32_t head = atomic_load_explicit(&sb_head, memory_order_acquire);
+      Assert(tail - head <= CONFIG_SB_SIZE, "audio stream buffer overflow: head = %u, tail = %u", head, tail);
+      atomic_store_explicit(&sb_tail, tail, memory_order_release);
+      if (wav_fp != NULL) wav_drain();
+      break;
+    }
+    default: panic("audio register %d is read-only", reg);
   }
-  set_buf_count(buf_count + len);
-  SDL_UnlockAudio();
 }
 
 void init_audio() {
@@ -95,7 +205,7 @@ void init_audio() {
   add_mmio_map("audio", CONFIG_AUDIO_CTL_MMIO, audio_base, space_size, audio_io_handler);
 #endif
 
+  // the guest writes samples in place, so no callback is needed
   sbuf = (uint8_t *)new_space(CONFIG_SB_SIZE);
-  set_buf_count(0);
-  add_mmio_map("audio-sbuf", CONFIG_SB_ADDR, sbuf, CONFIG_SB_SIZE, audio_sbuf_handler);
+  add_mmio_map("audio-sbuf", CONFIG_SB_ADDR, sbuf, CONFIG_SB_SIZE, NULL);
 }
@@ -0,0 +1,83 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <device/map.h>
+#include <device/intr.h>
+
+/* The core-local interruptor of RISC-V. mtime is not a register, but a
+ * function of the number of guest instructions, so timer interrupts are
+ * deterministic, and NEMU spends nothing on the timer between accesses.
+ * A write to mtimecmp turns it into a deadline in instructions, and MTIP
+ * is a single comparison with the instruction counter.
+ */
+
+#define CLINT_MSIP     0x0000
+#define CLINT_MTIMECMP 0x4000
+#define CLINT_MTIME    0xbff8
+#define CLINT_SIZE     0x10000
+
+extern uint64_t g_nr_guest_inst;
+
+static uint8_t *clint_base = NULL;
+static uint64_t mtime_offset = 0;
+static uint64_t deadline = UINT64_MAX;
+
+#define reg64(off) (*(uint64_t *)(clint_base + (off)))
+
+uint64_t clint_mtime() {
+  return g_nr_guest_inst / CONFIG_CLINT_TICK_INST + mtime_offset;
+}
+
+static void update_deadline() {
+  uint64_t now = clint_mtime();
+  uint64_t cmp = reg64(CLINT_MTIMECMP);
+  if (cmp <= now) deadline = 0;
+  else if (cmp - now > (UINT64_MAX - g_nr_guest_inst) / CONFIG_CLINT_TICK_INST) deadline = UINT64_MAX;
+  else deadline = (g_nr_guest_inst / CONFIG_CLINT_TICK_INST + (cmp - now)) * CONFIG_CLINT_TICK_INST;
+}
+
+bool clint_mtip() {
+  return g_nr_guest_inst >= deadline;
+}
+
+bool clint_msip() {
+  return clint_base[CLINT_MSIP] & 1;
+}
+
+static void clint_io_handler(uint32_t offset, int len, bool is_write) {
+  if (offset >= CLINT_MTIME && offset < CLINT_MTIME + 8) {
+    if (!is_write) { reg64(CLINT_MTIME) = clint_mtime(); return; }
+    // the bytes written are new, and the others are taken from the current time
+    uint64_t val = clint_mtime();
+    memcpy((uint8_t *)&val + (offset - CLINT_MTIME), clint_base + offset, len);
+    mtime_offset += val - clint_mtime();
+    reg64(CLINT_MTIME) = val;
+    update_deadline();
+  } else if (offset >= CLINT_MTIMECMP && offset < CLINT_MTIMECMP + 8) {
+    if (is_write) update_deadline();
+  } else if (offset < CLINT_MSIP + 4) {
+    if (is_write) *(uint32_t *)(clint_base + CLINT_MSIP) &= 1;
+  } else if (is_write) {
+    panic("write to the reserved CLINT offset 0x%x", offset);
+  }
+}
+
+void init_clint() {
+  clint_base = new_space(CLINT_SIZE);
+  memset(clint_base, 0, CLINT_SIZE);
+  reg64(CLINT_MTIMECMP) = UINT64_MAX;
+  add_mmio_map("clint", CONFIG_CLINT_MMIO, clint_base, CLINT_SIZE, clint_io_handler);
+}
@@ -18,68 +18,137 @@
 #include <device/alarm.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
+#include <stdatomic.h>
 #endif
 
 void init_map();
 void init_serial();
 void init_timer();
 void init_vga();
+void init_gpu();
 void init_i8042();
 void init_audio();
 void init_disk();
 void init_sdcard();
+void init_clint();
+void init_plic();
 void init_alarm();
 
 void send_key(uint8_t, bool);
 void vga_update_screen();
+void serial_flush();
+void serial_update_irq();
+void timer_page_update(uint64_t us);
 
-void device_update() {
-  static uint64_t last = 0;
-  uint64_t now = get_time();
-  if (now - last < 1000000 / TIMER_HZ) {
-    return;
-  }
-  last = now;
+#ifndef CONFIG_TARGET_AM
+#define EV_QUIT    0x10000
+#define EV_KEYDOWN 0x100
 
-  IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+static void handle_event(uint32_t ev) {
+  if (ev & EV_QUIT) nemu_state.state = NEMU_QUIT;
+  else IFDEF(CONFIG_HAS_KEYBOARD, send_key(ev & 0xff, ev & EV_KEYDOWN));
+}
 
-#ifndef CONFIG_TARGET_AM
+#ifdef CONFIG_VGA_SHOW_SCREEN
+/* With the screen shown, SDL events are polled by the render thread of VGA,
+ * and passed to the CPU thread through a single-producer single-consumer
+ * queue. Events are dropped if the queue is full, since the render thread
+ * must not wait for the CPU.
+ */
+#define EVENT_QUEUE_LEN 256
+static uint32_t event_queue[EVENT_QUEUE_LEN] = {};
+static atomic_uint event_head = 0, event_tail = 0;
+
+static void event_enqueue(uint32_t ev) {
+  unsigned tail = atomic_load_explicit(&event_tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&event_head, memory_order_acquire);
+  if (tail - head == EVENT_QUEUE_LEN) return;
+  event_queue[tail % EVENT_QUEUE_LEN] = ev;
+  atomic_store_explicit(&event_tail, tail + 1, memory_order_release);
+}
+
+static bool event_dequeue(uint32_t *ev) {
+  unsigned head = atomic_load_explicit(&event_head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&event_tail, memory_order_acquire);
+  if (head == tail) return false;
+  *ev = event_queue[head % EVENT_QUEUE_LEN];
+  atomic_store_explicit(&event_head, head + 1, memory_order_release);
+  return true;
+}
+
+static void handle_queued_events() {
+  uint32_t ev;
+  while (event_dequeue(&ev)) handle_event(ev);
+}
+#endif
+
+void sdl_poll_events() {
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
+    uint32_t ev;
     switch (event.type) {
-      case SDL_QUIT:
-        nemu_state.state = NEMU_QUIT;
-        break;
+      case SDL_QUIT: ev = EV_QUIT; break;
 #ifdef CONFIG_HAS_KEYBOARD
       // If a key was pressed
       case SDL_KEYDOWN:
-      case SDL_KEYUP: {
-        uint8_t k = event.key.keysym.scancode;
-        bool is_keydown = (event.key.type == SDL_KEYDOWN);
-        send_key(k, is_keydown);
+      case SDL_KEYUP:
+        ev = (uint8_t)event.key.keysym.scancode | (event.key.type == SDL_KEYDOWN ? EV_KEYDOWN : 0);
         break;
-      }
 #endif
-      default: break;
+      default: continue;
     }
+    MUXDEF(CONFIG_VGA_SHOW_SCREEN, event_enqueue(ev), handle_event(ev));
+  }
+}
+#endif
+
+void device_update() {
+  static uint64_t last = 0;
+  PERF_INC(device_update);
+  uint64_t now = get_time();
+  IFDEF(CONFIG_HAS_TIMER, timer_page_update(now));
+  if (now - last < 1000000 / TIMER_HZ) {
+    return;
   }
+  last = now;
+  PERF_INC(device_sync);
+
+  IFDEF(CONFIG_HAS_SERIAL, serial_flush());
+  IFDEF(CONFIG_SERIAL_INPUT_FIFO, serial_update_irq());
+  IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+#ifndef CONFIG_TARGET_AM
+  MUXDEF(CONFIG_VGA_SHOW_SCREEN, handle_queued_events(), sdl_poll_events());
 #endif
 }
 
+// write out the output buffered by devices
+void device_flush() {
+  IFDEF(CONFIG_HAS_SERIAL, serial_flush());
+}
+
 void sdl_clear_event_queue() {
 #ifndef CONFIG_TARGET_AM
+#ifdef CONFIG_VGA_SHOW_SCREEN
+  uint32_t ev;
+  while (event_dequeue(&ev));
+#else
   SDL_Event event;
   while (SDL_PollEvent(&event));
 #endif
+#endif
 }
 
 void init_device() {
   IFDEF(CONFIG_TARGET_AM, ioe_init());
   init_map();
 
+  // the interrupt controllers come first, since the devices drive them
+  IFDEF(CONFIG_HAS_CLINT, init_clint());
+  IFDEF(CONFIG_HAS_PLIC, init_plic());
   IFDEF(CONFIG_HAS_SERIAL, init_serial());
   IFDEF(CONFIG_HAS_TIMER, init_timer());
   IFDEF(CONFIG_HAS_VGA, init_vga());
+  IFDEF(CONFIG_HAS_GPU, init_gpu());
   IFDEF(CONFIG_HAS_KEYBOARD, init_i8042());
   IFDEF(CONFIG_HAS_AUDIO, init_audio());
   IFDEF(CONFIG_HAS_DISK, init_disk());
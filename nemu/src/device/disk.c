@@ -14,6 +14,156 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/paddr.h>
+#include <device/intr.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* A paravirtual block device. The guest posts requests into a ring of
+ * descriptors in its memory, and rings the doorbell by writing the head
+ * index. NEMU serves every descriptor between tail and head at once with
+ * memcpy() between the mmap()ed image and pmem, writes the status back to
+ * the descriptor, advances tail, and sets DONE in status. The interrupt
+ * line is asserted while DONE is set and interrupts are enabled, and the
+ * guest acknowledges it by writing 1 to DONE. The requests of a bad ring
+ * fail with ERROR, and those whose descriptors can be found are completed.
+ * head and tail are free-running, and the index into the ring is taken
+ * modulo the ring size, which must be a power of 2.
+ */
+
+#define BLKSZ 512
+
+enum {
+  reg_blksz,      // RO
+  reg_blkcnt,     // RO
+  reg_ring_base,  // physical address of the descriptor ring
+  reg_ring_size,  // number of descriptors
+  reg_head,       // written by the guest, the doorbell
+  reg_tail,       // RO, advanced by NEMU
+  reg_status,     // write 1 to clear DONE and ERROR
+  reg_intr_en,    // raise an interrupt when requests complete
+  nr_reg
+};
+
+enum { DISK_PRESENT = 1, DISK_ERROR = 2, DISK_DONE = 4 };
+enum { DISK_CMD_READ, DISK_CMD_WRITE };
+enum { DESC_PENDING, DESC_OK, DESC_ERROR };
+
+typedef struct {
+  uint32_t cmd;
+  uint32_t blkno;
+  uint32_t blkcnt;
+  uint32_t buf;     // physical address
+  uint32_t status;  // written by NEMU
+} DiskDesc;
+
+static uint32_t *disk_base = NULL;
+// the register is overwritten by the guest before the callback sees it
+static uint32_t disk_status = 0;
+static uint8_t *img = NULL;
+static uint32_t img_blkcnt = 0;
+static bool img_writable = false;
+static char *img_file = CONFIG_DISK_IMG_PATH;
+
+void disk_set_img_file(char *file) {
+  img_file = file;
+}
+
+static uint32_t serve(DiskDesc *d) {
+  uint64_t len = (uint64_t)d->blkcnt * BLKSZ;
+  if (d->cmd > DISK_CMD_WRITE || (uint64_t)d->blkno + d->blkcnt > img_blkcnt ||
+      !in_pmem_range(d->buf, len) || (d->cmd == DISK_CMD_WRITE && !img_writable)) {
+    return DESC_ERROR;
+  }
+  uint8_t *blk = img + (uint64_t)d->blkno * BLKSZ;
+  uint8_t *buf = guest_to_host(d->buf);
+  if (d->cmd == DISK_CMD_READ) {
+    memcpy(buf, blk, len);
+    pmem_dma_sync(d->buf, len);
+  } else {
+    memcpy(blk, buf, len);
+  }
+  return DESC_OK;
+}
+
+static void disk_update_irq() {
+  dev_set_irq(IRQ_DISK, disk_base[reg_intr_en] && (disk_status & DISK_DONE));
+}
+
+// write the status back, unless the descriptor is out of pmem
+static void complete(paddr_t addr, uint32_t status) {
+  if (!in_pmem_range(addr, sizeof(DiskDesc))) return;
+  DiskDesc *d = (DiskDesc *)guest_to_host(addr);
+  d->status = status;
+  pmem_dma_sync(addr + offsetof(DiskDesc, status), sizeof(d->status));
+}
+
+static void disk_kick() {
+  uint32_t size = disk_base[reg_ring_size];
+  paddr_t base = disk_base[reg_ring_base];
+  uint32_t head = disk_base[reg_head];
+  uint32_t tail = disk_base[reg_tail];
+  bool size_ok = size != 0 && (size & (size - 1)) == 0 && head - tail <= size;
+  bool ring_ok = size_ok && in_pmem_range(base, (uint64_t)size * sizeof(DiskDesc));
+  // every request of a bad ring fails, and the descriptors which can be
+  // found still complete, so that the guest does not wait for them forever
+  for (; size_ok && tail != head; tail ++) {
+    paddr_t addr = base + (tail & (size - 1)) * sizeof(DiskDesc);
+    uint32_t status = (ring_ok ? serve((DiskDesc *)guest_to_host(addr)) : DESC_ERROR);
+    complete(addr, status);
+    if (status != DESC_OK) disk_status |= DISK_ERROR;
+  }
+  if (!size_ok) disk_status |= DISK_ERROR;
+  disk_base[reg_tail] = head;
+  disk_status |= DISK_DONE;
+}
+
+static void disk_io_handler(uint32_t offset, int len, bool is_write) {
+  int reg = offset / 4;
+  assert(reg < nr_reg);
+  if (!is_write) return;
+  switch (reg) {
+    case reg_ring_base: case reg_ring_size: case reg_intr_en: break;
+    case reg_head: disk_kick(); break;
+    case reg_status: disk_status &= ~(disk_base[reg_status] & (DISK_DONE | DISK_ERROR)); break;
+    default: panic("disk register %d is read-only", reg);
+  }
+  disk_base[reg_status] = disk_status;
+  disk_update_irq();
+}
+
+static void init_img() {
+  if (img_file == NULL || img_file[0] == '\0') return;
+  int fd = open(img_file, O_RDWR);
+  img_writable = (fd >= 0);
+  if (fd < 0) fd = open(img_file, O_RDONLY);
+  Assert(fd >= 0, "Can not open disk image '%s'", img_file);
+  struct stat st;
+  Assert(fstat(fd, &st) == 0, "Can not stat disk image '%s'", img_file);
+  img_blkcnt = st.st_size / BLKSZ;
+  if (img_blkcnt > 0) {
+    img = mmap(NULL, (size_t)img_blkcnt * BLKSZ, PROT_READ | (img_writable ? PROT_WRITE : 0),
+        MAP_SHARED, fd, 0);
+    Assert(img != MAP_FAILED, "Can not mmap disk image '%s'", img_file);
+  }
+  close(fd);
+  Log("Disk image '%s' has %u blocks%s", img_file, img_blkcnt, img_writable ? "" : ", read-only");
+}
 
 void init_disk() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  disk_base = (uint32_t *)new_space(space_size);
+  init_img();
+  disk_base[reg_blksz] = BLKSZ;
+  disk_base[reg_blkcnt] = img_blkcnt;
+  disk_status = (img_blkcnt > 0 ? DISK_PRESENT : 0);
+  disk_base[reg_status] = disk_status;
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("disk", CONFIG_DISK_CTL_PORT, disk_base, space_size, disk_io_handler);
+#else
+  add_mmio_map("disk", CONFIG_DISK_CTL_MMIO, disk_base, space_size, disk_io_handler);
+#endif
 }
@@ -0,0 +1,235 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/map.h>
+#include <memory/paddr.h>
+#include <stddef.h>
+
+/* A 2D accelerator for the VGA frame buffer. It owns a video memory which
+ * is not mapped to the guest, and is filled with COPY from pmem. The guest
+ * sets the arguments and writes a command to `cmd', and NEMU executes the
+ * command at once on the host:
+ *   COPY    size bytes from src (physical address) to dst in video memory
+ *   BLIT    a w * h rectangle of pixels from src (physical address, pitch
+ *           pixels per row, w if 0) to (x, y) of the frame buffer
+ *   FILL    a w * h rectangle at (x, y) of the frame buffer with color
+ *   RENDER  the canvas tree rooted at src in video memory to the screen,
+ *           with the semantics of AM_GPU_RENDER
+ * Rectangles are clipped to the screen. status is 0 if the last command
+ * succeeds, and 1 if its arguments are invalid. The guest probes for the
+ * accelerator with bit 0 of the capability register of vgactl.
+ */
+
+enum {
+  reg_vmemsz,  // RO
+  reg_status,  // RO
+  reg_src,
+  reg_dst,
+  reg_size,
+  reg_x, reg_y, reg_w, reg_h,
+  reg_pitch,
+  reg_color,
+  reg_cmd,
+  nr_reg
+};
+
+enum { GPU_CMD_COPY = 1, GPU_CMD_BLIT, GPU_CMD_FILL, GPU_CMD_RENDER };
+enum { GPU_OK, GPU_ERROR };
+
+// the same as struct gpu_canvas in amdev.h of AM
+enum { CANVAS_TEXTURE = 1, CANVAS_SUBTREE = 2 };
+#define CANVAS_NULL 0xffffffffu
+
+typedef struct {
+  uint16_t type, w, h, x1, y1, w1, h1;
+  uint32_t sibling;
+  union {
+    uint32_t child;
+    struct {
+      uint16_t w, h;
+      uint32_t pixels;
+    } __attribute__((packed)) texture;
+  };
+} __attribute__((packed)) GpuCanvas;
+
+static_assert(sizeof(GpuCanvas) == 26, "GpuCanvas must match struct gpu_canvas of AM");
+
+// bound the work of a malformed tree, which may contain cycles
+#define MAX_DEPTH 16
+#define MAX_NODES 4096
+
+uint32_t *vga_framebuffer(int *w, int *h);
+void vga_mark_dirty(int x, int y, int w, int h);
+
+static uint32_t *gpu_base = NULL;
+static uint8_t *gpu_vmem = NULL;
+static int nr_nodes = 0;
+
+static bool in_vmem(uint32_t off, uint64_t len) {
+  return off <= CONFIG_GPU_VMEM_SIZE && len <= CONFIG_GPU_VMEM_SIZE - off;
+}
+
+// clip the rectangle to the screen, and return false if nothing is left
+static bool clip(int *x, int *y, int *w, int *h, int *dx, int *dy, int W, int H) {
+  // the guest controls all of them, so compute in 64 bits to avoid overflow
+  int64_t x0 = *x, y0 = *y, x1 = x0 + *w, y1 = y0 + *h;
+  if (*w <= 0 || *h <= 0 || x0 >= W || y0 >= H || x1 <= 0 || y1 <= 0) return false;
+  *dx = (x0 < 0 ? -x0 : 0);
+  *dy = (y0 < 0 ? -y0 : 0);
+  if (x0 < 0) x0 = 0;
+  if (y0 < 0) y0 = 0;
+  if (x1 > W) x1 = W;
+  if (y1 > H) y1 = H;
+  *x = x0; *w = x1 - x0;
+  *y = y0; *h = y1 - y0;
+  return true;
+}
+
+static bool gpu_copy() {
+  uint32_t src = gpu_base[reg_src], dst = gpu_base[reg_dst], size = gpu_base[reg_size];
+  if (!in_pmem_range(src, size) || !in_vmem(dst, size)) return false;
+  memcpy(gpu_vmem + dst, guest_to_host(src), size);
+  return true;
+}
+
+static bool gpu_blit() {
+  int W, H;
+  uint32_t *fb = vga_framebuffer(&W, &H);
+  int x = (int32_t)gpu_base[reg_x], y = (int32_t)gpu_base[reg_y];
+  int w = (int32_t)gpu_base[reg_w], h = (int32_t)gpu_base[reg_h];
+  uint32_t pitch = gpu_base[reg_pitch] ? gpu_base[reg_pitch] : w;
+  if (w <= 0 || h <= 0) return true;
+  if (!in_pmem_range(gpu_base[reg_src], ((uint64_t)(h - 1) * pitch + w) * sizeof(uint32_t))) return false;
+  int dx, dy;
+  if (!clip(&x, &y, &w, &h, &dx, &dy, W, H)) return true;
+  uint32_t *src = (uint32_t *)guest_to_host(gpu_base[reg_src]) + (size_t)dy * pitch + dx;
+  for (int i = 0; i < h; i ++) {
+    memcpy(&fb[(y + i) * W + x], &src[(size_t)i * pitch], w * sizeof(uint32_t));
+  }
+  vga_mark_dirty(x, y, w, h);
+  return true;
+}
+
+static bool gpu_fill() {
+  int W, H;
+  uint32_t *fb = vga_framebuffer(&W, &H);
+  int x = (int32_t)gpu_base[reg_x], y = (int32_t)gpu_base[reg_y];
+  int w = (int32_t)gpu_base[reg_w], h = (int32_t)gpu_base[reg_h];
+  uint32_t color = gpu_base[reg_color];
+  int dx, dy;
+  if (!clip(&x, &y, &w, &h, &dx, &dy, W, H)) return true;
+  for (int j = 0; j < w; j ++) fb[y * W + x + j] = color;
+  for (int i = 1; i < h; i ++) {
+    memcpy(&fb[(y + i) * W + x], &fb[y * W + x], w * sizeof(uint32_t));
+  }
+  vga_mark_dirty(x, y, w, h);
+  return true;
+}
+
+/* Scale the w * h pixels of a node with the nearest neighbor into the
+ * (x1, y1, w1, h1) rectangle of its parent, which is W * H pixels.
+ */
+static void composite(uint32_t *dst, int W, int H, const uint32_t *src, int w, int h,
+    const GpuCanvas *cv) {
+  int x = cv->x1, y = cv->y1, w1 = cv->w1, h1 = cv->h1, dx, dy;
+  if (w == 0 || h == 0 || !clip(&x, &y, &w1, &h1, &dx, &dy, W, H)) return;
+  if (cv->w1 == w && cv->h1 == h) {
+    for (int i = 0; i < h1; i ++) {
+      memcpy(&dst[(size_t)(y + i) * W + x], &src[(size_t)(dy + i) * w + dx], w1 * sizeof(uint32_t));
+    }
+    return;
+  }
+  // the source column of every destination column, w1 is at most 65535
+  static int col[65536];
+  for (int j = 0; j < w1; j ++) col[j] = (int64_t)(dx + j) * w / cv->w1;
+  for (int i = 0; i < h1; i ++) {
+    const uint32_t *s = &src[(size_t)((int64_t)(dy + i) * h / cv->h1) * w];
+    uint32_t *d = &dst[(size_t)(y + i) * W + x];
+    for (int j = 0; j < w1; j ++) d[j] = s[col[j]];
+  }
+}
+
+static bool render(uint32_t off, uint32_t *dst, int W, int H, int depth) {
+  if (depth > MAX_DEPTH || ++ nr_nodes > MAX_NODES || !in_vmem(off, sizeof(GpuCanvas))) return false;
+  GpuCanvas cv;
+  memcpy(&cv, gpu_vmem + off, sizeof(cv));
+  switch (cv.type) {
+    case CANVAS_TEXTURE: {
+      uint32_t w = cv.texture.w, h = cv.texture.h;
+      if (!in_vmem(cv.texture.pixels, (uint64_t)w * h * sizeof(uint32_t))) return false;
+      composite(dst, W, H, (uint32_t *)(gpu_vmem + cv.texture.pixels), w, h, &cv);
+      return true;
+    }
+    case CANVAS_SUBTREE: {
+      // the scratch canvas is bounded by the size of the video memory
+      if ((uint64_t)cv.w * cv.h * sizeof(uint32_t) > CONFIG_GPU_VMEM_SIZE) return false;
+      uint32_t *buf = calloc((size_t)cv.w * cv.h + 1, sizeof(uint32_t));
+      bool ok = true;
+      for (uint32_t ch = cv.child; ok && ch != CANVAS_NULL; ) {
+        ok = render(ch, buf, cv.w, cv.h, depth + 1);
+        if (ok) memcpy(&ch, gpu_vmem + ch + offsetof(GpuCanvas, sibling), sizeof(ch));
+      }
+      if (ok) composite(dst, W, H, buf, cv.w, cv.h, &cv);
+      free(buf);
+      return ok;
+    }
+    default: return false;
+  }
+}
+
+static bool gpu_render() {
+  int W, H;
+  uint32_t *fb = vga_framebuffer(&W, &H);
+  nr_nodes = 0;
+  bool ok = render(gpu_base[reg_src], fb, W, H, 0);
+  // a failed render may have drawn part of the tree
+  vga_mark_dirty(0, 0, W, H);
+  return ok;
+}
+
+static void gpu_io_handler(uint32_t offset, int len, bool is_write) {
+  int reg = offset / 4;
+  assert(reg < nr_reg);
+  if (!is_write) return;
+  bool ok;
+  switch (reg) {
+    case reg_vmemsz: case reg_status: panic("gpu register %d is read-only", reg);
+    case reg_cmd:
+      switch (gpu_base[reg_cmd]) {
+        case GPU_CMD_COPY:   ok = gpu_copy();   break;
+        case GPU_CMD_BLIT:   ok = gpu_blit();   break;
+        case GPU_CMD_FILL:   ok = gpu_fill();   break;
+        case GPU_CMD_RENDER: ok = gpu_render(); break;
+        default: ok = false; break;
+      }
+      gpu_base[reg_status] = (ok ? GPU_OK : GPU_ERROR);
+      break;
+    default: break;
+  }
+}
+
+void init_gpu() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  gpu_base = (uint32_t *)new_space(space_size);
+  gpu_vmem = calloc(CONFIG_GPU_VMEM_SIZE, 1);
+  assert(gpu_vmem);
+  gpu_base[reg_vmemsz] = CONFIG_GPU_VMEM_SIZE;
+  gpu_base[reg_status] = GPU_OK;
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("gpu", CONFIG_GPU_CTL_PORT, gpu_base, space_size, gpu_io_handler);
+#else
+  add_mmio_map("gpu", CONFIG_GPU_CTL_MMIO, gpu_base, space_size, gpu_io_handler);
+#endif
+}
@@ -13,7 +13,9 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
-#include <isa.h>
+#include <device/intr.h>
 
-void dev_raise_intr() {
+void dev_set_irq(int irq, bool level) {
+  assert(irq > IRQ_NONE && irq < NR_IRQ);
+  IFDEF(CONFIG_HAS_PLIC, plic_set_irq(irq, level));
 }
@@ -56,6 +56,8 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+  IFDEF(CONFIG_TRACE_TRIGGER, if (unlikely(g_trigger_mmio_armed)) trigger_check_mmio(map->name));
+  IFDEF(CONFIG_PERF_COUNTER, map->perf[0] ++);
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
   IFDEF(CONFIG_DTRACE, log_write("[dtrace] read %10s at " FMT_PADDR ",%d\n",
@@ -67,6 +69,8 @@ void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+  IFDEF(CONFIG_TRACE_TRIGGER, if (unlikely(g_trigger_mmio_armed)) trigger_check_mmio(map->name));
+  IFDEF(CONFIG_PERF_COUNTER, map->perf[1] ++);
   host_write(map->space + offset, len, data);
   invoke_callback(map->callback, offset, len, true);
   IFDEF(CONFIG_DTRACE, log_write("[dtrace] write %10s at " FMT_PADDR ",%d with " FMT_WORD "\n",
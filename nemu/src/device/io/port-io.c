@@ -27,6 +27,7 @@ void add_pio_map(const char *name, ioaddr_t addr, void *space, uint32_t len, io_
   assert(addr + len <= PORT_IO_SPACE_MAX);
   maps[nr_map] = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
     .space = space, .callback = callback };
+  IFDEF(CONFIG_PERF_COUNTER, maps[nr_map].perf = perf_map_counter(name));
   Log("Add port-io map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
       maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
 
@@ -14,6 +14,7 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/intr.h>
 #include <utils.h>
 
 #define KEYDOWN_MASK 0x8000
@@ -53,6 +54,7 @@ static void key_enqueue(uint32_t am_scancode) {
   key_queue[key_r] = am_scancode;
   key_r = (key_r + 1) % KEY_QUEUE_LEN;
   Assert(key_r != key_f, "key queue overflow!");
+  dev_set_irq(IRQ_KEYBOARD, true);
 }
 
 static uint32_t key_dequeue() {
@@ -61,6 +63,8 @@ static uint32_t key_dequeue() {
     key = key_queue[key_f];
     key_f = (key_f + 1) % KEY_QUEUE_LEN;
   }
+  // the line is asserted while there are keys to read
+  dev_set_irq(IRQ_KEYBOARD, key_f != key_r);
   return key;
 }
 
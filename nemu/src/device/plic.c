@@ -0,0 +1,106 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/map.h>
+#include <device/intr.h>
+
+/* The platform-level interrupt controller of RISC-V, with the layout of
+ * SiFive. Context 0 is the M-mode of the hart and drives MEIP, context 1
+ * is the S-mode and drives SEIP. The gateways are level-triggered: a
+ * source is pending while its line is asserted and it is not claimed, so
+ * a device still asserting its line after completion is pending again.
+ * The lines to the hart are recomputed whenever the state changes, so
+ * polling them between instructions is a load.
+ */
+
+#define NR_SRC 32
+#define NR_CTX 2
+#define PRIO_MASK 0x7
+
+#define PLIC_PRIORITY  0x000000
+#define PLIC_PENDING   0x001000
+#define PLIC_ENABLE    0x002000  // 0x80 bytes per context
+#define PLIC_THRESHOLD 0x200000  // 0x1000 bytes per context, claim/complete follows
+#define PLIC_SIZE      (PLIC_THRESHOLD + 0x1000 * NR_CTX)
+
+static uint8_t *plic_base = NULL;
+static uint32_t level = 0;
+static uint32_t claimed = 0;
+static bool eip[NR_CTX] = {};
+
+#define reg(off)       (*(uint32_t *)(plic_base + (off)))
+#define priority(src)  reg(PLIC_PRIORITY + 4 * (src))
+#define enable(ctx)    reg(PLIC_ENABLE + 0x80 * (ctx))
+#define threshold(ctx) reg(PLIC_THRESHOLD + 0x1000 * (ctx))
+#define claim(ctx)     reg(PLIC_THRESHOLD + 0x1000 * (ctx) + 4)
+
+// the pending and enabled source of the highest priority above the threshold
+static int best_src(int ctx) {
+  uint32_t pending = level & ~claimed & enable(ctx);
+  int best = 0;
+  uint32_t best_prio = threshold(ctx);
+  for (; pending != 0; pending &= pending - 1) {
+    int src = __builtin_ctz(pending);
+    if (priority(src) > best_prio) { best = src; best_prio = priority(src); }
+  }
+  return best;
+}
+
+static void plic_update() {
+  for (int ctx = 0; ctx < NR_CTX; ctx ++) eip[ctx] = best_src(ctx) != 0;
+}
+
+bool plic_eip(int ctx) {
+  return eip[ctx];
+}
+
+void plic_set_irq(int irq, bool lv) {
+  uint32_t bit = 1u << irq;
+  if (!!(level & bit) == lv) return;
+  level ^= bit;
+  plic_update();
+}
+
+static void plic_io_handler(uint32_t offset, int len, bool is_write) {
+  assert(len == 4 && (offset & 3) == 0);
+  if (offset >= PLIC_THRESHOLD) {
+    int ctx = (offset - PLIC_THRESHOLD) / 0x1000;
+    if ((offset & 0xfff) == 4) {
+      if (!is_write) {
+        int src = best_src(ctx);
+        claimed |= (1u << src) & ~1u;
+        claim(ctx) = src;
+        plic_update();
+      } else if (claim(ctx) < NR_SRC) {
+        claimed &= ~(1u << claim(ctx));
+      }
+    }
+  } else if (offset >= PLIC_ENABLE) {
+    // source 0 does not exist
+    if (is_write) enable((offset - PLIC_ENABLE) / 0x80) &= ~1u;
+  } else if (offset >= PLIC_PENDING) {
+    if (is_write) panic("PLIC pending bits are read-only");
+    reg(PLIC_PENDING) = level & ~claimed;
+  } else if (is_write) {
+    priority(offset / 4) &= (offset == 0 ? 0 : PRIO_MASK);
+  }
+  if (is_write) plic_update();
+}
+
+void init_plic() {
+  plic_base = new_space(PLIC_SIZE);
+  memset(plic_base, 0, PLIC_SIZE);
+  add_mmio_map("plic", CONFIG_PLIC_MMIO, plic_base, PLIC_SIZE, plic_io_handler);
+}
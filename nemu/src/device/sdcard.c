@@ -14,6 +14,11 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/paddr.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "mmc.h"
 
 // http://www.files.e-shop.co.il/pdastore/Tech-mmc-samsung/SEC%20MMC%20SPEC%20ver09.pdf
@@ -28,8 +33,17 @@
 #define C_SIZE (NR_BLOCK / MULT - 1)
 
 // This is a simple hardware implementation of linux/drivers/mmc/host/bcm2835.c
-// No DMA and IRQ is supported, so the driver must be modified to start PIO
+// No IRQ is supported, so the driver must be modified to start PIO
 // right after sending the actual read/write commands.
+//
+// The image is mmap()ed, and SDDATA accesses it directly. Instead of PIO,
+// the driver may also move whole blocks with the DMA registers, which are
+// not in the real controller: write the physical address of the buffer to
+// SDDMAADDR, then write the number of 512-byte blocks to SDDMACNT. The
+// blocks are transferred at the current position of the read/write command
+// before the write of SDDMACNT returns, and the position advances. A transfer
+// beyond the image or pmem is not done, and sets SDHSTS_FIFO_ERROR instead,
+// which is cleared by writing 1 to it.
 
 enum {
   SDCMD, SDARG, SDTOUT, SDCDIV,
@@ -37,24 +51,52 @@ enum {
   SDHSTS, __PAD0, __PAD1, __PAD2,
   SDVDD, SDEDM, SDHCFG, SDHBCT,
   SDDATA, __PAD10, __PAD11, __PAD12,
-  SDHBLC
+  SDHBLC, SDDMAADDR, SDDMACNT
 };
 
-static FILE *fp = NULL;
+#define SDHSTS_FIFO_ERROR 0x08
+
+static uint8_t *img = NULL;
+static uint64_t img_size = 0;
 static uint32_t *base = NULL;
 static uint32_t blkcnt = 0;
-static long blk_addr = 0;
+static uint64_t blk_addr = 0;
 static uint32_t addr = 0;
 static bool write_cmd = 0;
 static bool read_ext_csd = false;
+// SDHSTS is overwritten by the guest before the callback sees it
+static uint32_t hsts = 0;
 
 static void prepare_rw(int is_write) {
   blk_addr = base[SDARG];
   addr = 0;
-  if (fp) fseek(fp, blk_addr << 9, SEEK_SET);
   write_cmd = is_write;
 }
 
+// return the image at the current position if `len' bytes are available
+static uint8_t *data_ptr(uint64_t len) {
+  uint64_t pos = (blk_addr << 9) + addr;
+  return (img != NULL && pos + len <= img_size) ? img + pos : NULL;
+}
+
+static void sdcard_dma(uint32_t nr_blk) {
+  paddr_t buf = base[SDDMAADDR];
+  uint64_t len = (uint64_t)nr_blk << 9;
+  uint8_t *p = data_ptr(len);
+  if (p == NULL || !in_pmem_range(buf, len)) {
+    Log("sdcard DMA of %u blocks at " FMT_PADDR " is out of the image or pmem", nr_blk, buf);
+    hsts |= SDHSTS_FIFO_ERROR;
+    return;
+  }
+  if (write_cmd) {
+    memcpy(p, guest_to_host(buf), len);
+  } else {
+    memcpy(guest_to_host(buf), p, len);
+    pmem_dma_sync(buf, len);
+  }
+  addr += len;
+}
+
 static void sdcard_handle_cmd(int cmd) {
   switch (cmd) {
     case MMC_GO_IDLE_STATE: break;
@@ -90,6 +132,7 @@ static void sdcard_handle_cmd(int cmd) {
 
 static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
   int idx = offset / 4;
+  uint8_t *p;
   switch (idx) {
     case SDCMD: sdcard_handle_cmd(base[SDCMD] & 0x3f); break;
     case SDARG:
@@ -98,6 +141,12 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
     case SDRSP2:
     case SDRSP3:
       break;
+    case SDHSTS:
+      if (is_write) hsts &= ~base[SDHSTS];
+      base[SDHSTS] = hsts;
+      break;
+    case SDDMAADDR: break;
+    case SDDMACNT: if (is_write) sdcard_dma(base[SDDMACNT]); break;
     case SDDATA:
        if (read_ext_csd) {
          // See section 8.1 JEDEC Standard JED84-A441
@@ -109,10 +158,9 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
          }
          base[SDDATA] = data;
          if (addr == 512 - 4) read_ext_csd = false;
-       } else if (fp) {
-         __attribute__((unused)) int ret;
-         if (!write_cmd) { ret = fread(&base[SDDATA], 4, 1, fp); }
-         else { ret = fwrite(&base[SDDATA], 4, 1, fp); }
+       } else if ((p = data_ptr(4)) != NULL) {
+         if (!write_cmd) memcpy(&base[SDDATA], p, 4);
+         else memcpy(p, &base[SDDATA], 4);
        }
        addr += 4;
        break;
@@ -128,7 +176,15 @@ void init_sdcard() {
 
   Assert(C_SIZE < (1 << 12), "shoule be fit in 12 bits");
 
-  const char *img = CONFIG_SDCARD_IMG_PATH;
-  fp = fopen(img, "r+");
-  if (fp == NULL) Log("Can not find sdcard image: %s", img);
+  const char *file = CONFIG_SDCARD_IMG_PATH;
+  int fd = open(file, O_RDWR);
+  if (fd < 0) { Log("Can not find sdcard image: %s", file); return; }
+  struct stat st;
+  Assert(fstat(fd, &st) == 0, "Can not stat sdcard image: %s", file);
+  img_size = st.st_size;
+  if (img_size > 0) {
+    img = mmap(NULL, img_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Assert(img != MAP_FAILED, "Can not mmap sdcard image: %s", file);
+  }
+  close(fd);
 }
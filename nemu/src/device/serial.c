@@ -15,29 +15,168 @@
 
 #include <utils.h>
 #include <device/map.h>
+#include <device/intr.h>
+#include <device/alarm.h>
 
 /* http://en.wikibooks.org/wiki/Serial_Programming/8250_UART_Programming */
 // NOTE: this is compatible to 16550
 
-#define CH_OFFSET 0
+#define CH_OFFSET  0
+#define IER_OFFSET 1
+#define IIR_OFFSET 2
+#define LCR_OFFSET 3
+#define LSR_OFFSET 5
+
+#define IER_RDI  0x01  // interrupt when received data is available
+#define IIR_NONE 0x01  // no interrupt is pending
+#define IIR_RDI  0x04  // received data is available
+#define LCR_DLAB 0x80  // offsets 0 and 1 are the divisor latch
+#define LSR_DR   0x01  // data ready
+#define LSR_THRE 0x20  // transmitter holding register empty
+#define LSR_TEMT 0x40  // transmitter empty
 
 static uint8_t *serial_base = NULL;
+// IER shares its offset with the divisor latch
+static uint8_t ier = 0;
 
+#ifdef CONFIG_TARGET_AM
+static void serial_putc(char ch) {
+  putch(ch);
+}
+
+void serial_flush() {}
+#else
+/* Output is buffered, and flushed on a newline, when the buffer is full,
+ * at each device update, when the CPU stops and at exit. This saves one
+ * write() to the host for every guest byte.
+ */
+static char obuf[4096];
+static int obuf_len = 0;
+
+void serial_flush() {
+  if (obuf_len == 0) return;
+  fwrite(obuf, 1, obuf_len, stderr);
+  obuf_len = 0;
+}
 
 static void serial_putc(char ch) {
-  MUXDEF(CONFIG_TARGET_AM, putch(ch), putc(ch, stderr));
+  obuf[obuf_len ++] = ch;
+  if (ch == '\n' || obuf_len == sizeof(obuf)) serial_flush();
+}
+#endif
+
+#ifdef CONFIG_SERIAL_INPUT_FIFO
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* The RX FIFO is filled by a reader thread, which blocks on the input so
+ * that the CPU thread never does. The input is /tmp/nemu.serial, which is
+ * created as a named pipe if it does not exist, or stdin with --serial=-.
+ * The FIFO is a single-producer single-consumer ring, so reading RBR and
+ * LSR is a couple of loads.
+ */
+#define RX_FIFO_LEN 4096
+static uint8_t rx_fifo[RX_FIFO_LEN];
+static atomic_uint rx_head = 0, rx_tail = 0;
+static char *serial_in_file = "/tmp/nemu.serial";
+
+void serial_set_input_file(char *file) {
+  serial_in_file = file;
+}
+
+static void rx_push(uint8_t ch) {
+  unsigned tail = atomic_load_explicit(&rx_tail, memory_order_relaxed);
+  // the reader thread can wait, but guest input must not be lost
+  while (tail - atomic_load_explicit(&rx_head, memory_order_acquire) == RX_FIFO_LEN) usleep(1000);
+  rx_fifo[tail % RX_FIFO_LEN] = ch;
+  atomic_store_explicit(&rx_tail, tail + 1, memory_order_release);
+}
+
+static bool rx_ready() {
+  return atomic_load_explicit(&rx_head, memory_order_relaxed) !=
+    atomic_load_explicit(&rx_tail, memory_order_acquire);
+}
+
+static uint8_t rx_pop() {
+  if (!rx_ready()) return 0;
+  unsigned head = atomic_load_explicit(&rx_head, memory_order_relaxed);
+  uint8_t ch = rx_fifo[head % RX_FIFO_LEN];
+  atomic_store_explicit(&rx_head, head + 1, memory_order_release);
+  return ch;
+}
+
+static void *serial_reader(void *arg) {
+  alarm_block_this_thread();
+
+  bool is_stdin = strcmp(serial_in_file, "-") == 0;
+  while (true) {
+    // opening a named pipe blocks until a writer appears
+    int fd = is_stdin ? STDIN_FILENO : open(serial_in_file, O_RDONLY);
+    if (fd < 0) { Log("Can not open '%s' for serial input", serial_in_file); return NULL; }
+    uint8_t buf[256];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+      for (ssize_t i = 0; i < n; i ++) rx_push(buf[i]);
+    }
+    // reopen a named pipe when the writer closes it, other files end at EOF
+    struct stat st;
+    bool is_fifo = !is_stdin && fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    if (!is_stdin) close(fd);
+    if (!is_fifo) return NULL;
+  }
+}
+
+static void init_fifo() {
+  if (strcmp(serial_in_file, "-") != 0 && access(serial_in_file, F_OK) != 0) {
+    Assert(mkfifo(serial_in_file, 0666) == 0, "Can not create '%s'", serial_in_file);
+  }
+  pthread_t t;
+  Assert(pthread_create(&t, NULL, serial_reader, NULL) == 0, "Can not create the serial reader thread");
+  pthread_detach(t);
+  Log("Serial input comes from '%s'", serial_in_file);
+}
+#else
+static inline bool rx_ready() { return false; }
+static inline uint8_t rx_pop() { return 0; }
+#endif
+
+/* Only the interrupt of received data is supported, since the output is
+ * never busy. The line is updated when the guest touches the UART, and at
+ * device updates for the input arriving in between.
+ */
+void serial_update_irq() {
+  dev_set_irq(IRQ_SERIAL, (ier & IER_RDI) && rx_ready());
 }
 
 static void serial_io_handler(uint32_t offset, int len, bool is_write) {
   assert(len == 1);
+  bool dlab = serial_base[LCR_OFFSET] & LCR_DLAB;
   switch (offset) {
     /* We bind the serial port with the host stderr in NEMU. */
     case CH_OFFSET:
+      if (dlab) break;
       if (is_write) serial_putc(serial_base[0]);
-      else panic("do not support read");
+      else serial_base[0] = rx_pop();
       break;
-    default: panic("do not support offset = %d", offset);
+    case IER_OFFSET:
+      if (dlab) break;
+      if (is_write) ier = serial_base[IER_OFFSET] & IER_RDI;
+      else serial_base[IER_OFFSET] = ier;
+      break;
+    case IIR_OFFSET:
+      // writes go to FCR, which is not readable
+      if (!is_write) serial_base[IIR_OFFSET] = ((ier & IER_RDI) && rx_ready()) ? IIR_RDI : IIR_NONE;
+      break;
+    case LSR_OFFSET:
+      if (!is_write) serial_base[LSR_OFFSET] = LSR_THRE | LSR_TEMT | (rx_ready() ? LSR_DR : 0);
+      break;
+    // the other registers only configure the line, and are kept as they are
+    default: break;
   }
+  serial_update_irq();
 }
 
 void init_serial() {
@@ -47,5 +186,6 @@ void init_serial() {
 #else
   add_mmio_map("serial", CONFIG_SERIAL_MMIO, serial_base, 8, serial_io_handler);
 #endif
-
+  IFDEF(CONFIG_SERIAL_INPUT_FIFO, init_fifo());
+  IFNDEF(CONFIG_TARGET_AM, atexit(serial_flush));
 }
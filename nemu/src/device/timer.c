@@ -14,11 +14,28 @@
 ***************************************************************************************/
 
 #include <device/map.h>
-#include <device/alarm.h>
+#include <memory/vaddr.h>
 #include <utils.h>
 
 static uint32_t *rtc_port_base = NULL;
 
+/* The timer page is a vDSO-like copy of the uptime. A read of it does no
+ * work in the callback, and NEMU updates it at every device update, which
+ * already reads the host time. A reader on a 32-bit guest should read the
+ * high word, the low word, then the high word again, and retry if the two
+ * high words differ.
+ */
+static uint32_t *rtc_page = NULL;
+
+void timer_page_update(uint64_t us) {
+  rtc_page[0] = (uint32_t)us;
+  rtc_page[1] = us >> 32;
+}
+
+static void rtc_page_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write) panic("the timer page is read-only");
+}
+
 static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
   assert(offset == 0 || offset == 4);
   if (!is_write && offset == 4) {
@@ -28,15 +45,6 @@ static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
   }
 }
 
-#ifndef CONFIG_TARGET_AM
-static void timer_intr() {
-  if (nemu_state.state == NEMU_RUNNING) {
-    extern void dev_raise_intr();
-    dev_raise_intr();
-  }
-}
-#endif
-
 void init_timer() {
   rtc_port_base = (uint32_t *)new_space(8);
 #ifdef CONFIG_HAS_PORT_IO
@@ -44,5 +52,7 @@ void init_timer() {
 #else
   add_mmio_map("rtc", CONFIG_RTC_MMIO, rtc_port_base, 8, rtc_io_handler);
 #endif
-  IFNDEF(CONFIG_TARGET_AM, add_alarm_handle(timer_intr));
+  rtc_page = (uint32_t *)new_space(PAGE_SIZE);
+  add_mmio_map("rtc-page", CONFIG_RTC_PAGE_MMIO, rtc_page, PAGE_SIZE, rtc_page_io_handler);
+  timer_page_update(get_time());
 }
@@ -15,6 +15,7 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <device/alarm.h>
 
 #define SCREEN_W (MUXDEF(CONFIG_VGA_SIZE_800x600, 800, 400))
 #define SCREEN_H (MUXDEF(CONFIG_VGA_SIZE_800x600, 600, 300))
@@ -38,14 +39,100 @@ static uint32_t *vgactl_port_base = NULL;
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 
+/* Guest stores to vmem record the range of columns they touch in each row.
+ * Consecutive dirty rows are merged into bands, and only the dirty part of
+ * each band is copied. Nothing is presented if no pixel has changed since
+ * the last sync.
+ */
+typedef struct {
+  uint16_t x0[SCREEN_H], x1[SCREEN_H]; // [x0, x1), clean if x0 >= x1
+  int y0, y1;                          // bounding rows [y0, y1)
+} DirtyMap;
+
+static void dirty_mark(DirtyMap *d, int x, int y, int w, int h) {
+  for (int i = y; i < y + h; i ++) {
+    if (x < d->x0[i]) d->x0[i] = x;
+    if (x + w > d->x1[i]) d->x1[i] = x + w;
+  }
+  if (y < d->y0) d->y0 = y;
+  if (y + h > d->y1) d->y1 = y + h;
+}
+
+static void dirty_clear(DirtyMap *d) {
+  for (int i = 0; i < SCREEN_H; i ++) { d->x0[i] = SCREEN_W; d->x1[i] = 0; }
+  d->y0 = SCREEN_H;
+  d->y1 = 0;
+}
+
+// call `f' with every dirty band, and leave `d' clean
+static void dirty_flush(DirtyMap *d, void (*f)(int x, int y, int w, int h)) {
+  for (int y = d->y0; y < d->y1; ) {
+    if (d->x0[y] >= d->x1[y]) { y ++; continue; }
+    int y_end = y, x0 = SCREEN_W, x1 = 0;
+    for (; y_end < d->y1 && d->x0[y_end] < d->x1[y_end]; y_end ++) {
+      if (d->x0[y_end] < x0) x0 = d->x0[y_end];
+      if (d->x1[y_end] > x1) x1 = d->x1[y_end];
+      d->x0[y_end] = SCREEN_W;
+      d->x1[y_end] = 0;
+    }
+    f(x0, y, x1 - x0, y_end - y);
+    y = y_end;
+  }
+  d->y0 = SCREEN_H;
+  d->y1 = 0;
+}
+
+/* Presentation runs on a render thread, since uploading the texture and
+ * SDL_RenderPresent() (which may wait for vsync) are slow. At a sync, the
+ * CPU thread copies the dirty bands of vmem into a snapshot, which is the
+ * second buffer of the frame, and wakes up the render thread. The CPU
+ * thread only tries to take the lock of the snapshot. If the render thread
+ * is uploading it, the sync is kept pending and retried at the next device
+ * update, so the CPU never waits for the display. The render thread also
+ * polls SDL events, see sdl_poll_events().
+ */
+static DirtyMap vmem_dirty;                    // owned by the CPU thread
+static uint32_t snapshot[SCREEN_W * SCREEN_H]; // protected by snap_lock
+static DirtyMap snap_dirty;                    // protected by snap_lock
+static SDL_mutex *snap_lock = NULL;
+static SDL_cond *snap_cond = NULL;
+
 static SDL_Renderer *renderer = NULL;
 static SDL_Texture *texture = NULL;
 
-static void init_screen() {
+static void vmem_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write) return;
+  uint32_t last = (offset + len - 1) / sizeof(uint32_t);
+  for (uint32_t p = offset / sizeof(uint32_t); p <= last; p ++) {
+    dirty_mark(&vmem_dirty, p % SCREEN_W, p / SCREEN_W, 1, 1);
+  }
+}
+
+static inline bool screen_dirty() {
+  return vmem_dirty.y0 < vmem_dirty.y1;
+}
+
+static inline void mark_dirty(int x, int y, int w, int h) {
+  dirty_mark(&vmem_dirty, x, y, w, h);
+}
+
+static void copy_band(int x, int y, int w, int h) {
+  uint32_t *fb = vmem;
+  for (int i = y; i < y + h; i ++) {
+    memcpy(&snapshot[i * SCREEN_W + x], &fb[i * SCREEN_W + x], w * sizeof(uint32_t));
+  }
+  dirty_mark(&snap_dirty, x, y, w, h);
+}
+
+static void upload_band(int x, int y, int w, int h) {
+  SDL_Rect rect = { .x = x, .y = y, .w = w, .h = h };
+  SDL_UpdateTexture(texture, &rect, &snapshot[y * SCREEN_W + x], SCREEN_W * sizeof(uint32_t));
+}
+
+static void init_window() {
   SDL_Window *window = NULL;
   char title[128];
   sprintf(title, "%s-NEMU", str(__GUEST_ISA__));
-  SDL_Init(SDL_INIT_VIDEO);
   SDL_CreateWindowAndRenderer(
       SCREEN_W * (MUXDEF(CONFIG_VGA_SIZE_400x300, 2, 1)),
       SCREEN_H * (MUXDEF(CONFIG_VGA_SIZE_400x300, 2, 1)),
@@ -56,42 +143,230 @@ static void init_screen() {
   SDL_RenderPresent(renderer);
 }
 
-static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
-  SDL_RenderClear(renderer);
-  SDL_RenderCopy(renderer, texture, NULL, NULL);
-  SDL_RenderPresent(renderer);
+static int render_thread(void *arg) {
+  alarm_block_this_thread();
+
+  // SDL requires the video subsystem to be initialized, and the window to
+  // be created, by the thread rendering it and polling its events
+  SDL_Init(SDL_INIT_VIDEO);
+  init_window();
+  SDL_SemPost((SDL_sem *)arg);
+
+  void sdl_poll_events();
+  SDL_LockMutex(snap_lock);
+  while (true) {
+    if (snap_dirty.y0 >= snap_dirty.y1) {
+      // wake up periodically to poll events
+      SDL_CondWaitTimeout(snap_cond, snap_lock, 1000 / TIMER_HZ);
+    }
+    bool present = snap_dirty.y0 < snap_dirty.y1;
+    dirty_flush(&snap_dirty, upload_band);
+    SDL_UnlockMutex(snap_lock);
+
+    if (present) {
+      SDL_RenderClear(renderer);
+      SDL_RenderCopy(renderer, texture, NULL, NULL);
+      SDL_RenderPresent(renderer);
+    }
+    sdl_poll_events();
+    SDL_LockMutex(snap_lock);
+  }
+  return 0;
+}
+
+static void init_screen() {
+  snap_lock = SDL_CreateMutex();
+  snap_cond = SDL_CreateCond();
+  dirty_clear(&snap_dirty);
+  dirty_clear(&vmem_dirty);
+  dirty_mark(&vmem_dirty, 0, 0, SCREEN_W, SCREEN_H);
+  // wait for the video subsystem, since the other subsystems are initialized
+  // by the CPU thread, and SDL_Init() is not thread-safe
+  SDL_sem *ready = SDL_CreateSemaphore(0);
+  SDL_Thread *t = SDL_CreateThread(render_thread, "nemu-render", ready);
+  Assert(t != NULL, "Can not create the render thread: %s", SDL_GetError());
+  SDL_DetachThread(t);
+  SDL_SemWait(ready);
+  SDL_DestroySemaphore(ready);
+}
+
+// return false if the render thread is busy, and the sync should be retried
+static inline bool update_screen() {
+  if (SDL_TryLockMutex(snap_lock) != 0) return false;
+  dirty_flush(&vmem_dirty, copy_band);
+  SDL_CondSignal(snap_cond);
+  SDL_UnlockMutex(snap_lock);
+  return true;
 }
 #else
+// the size of the screen is only known at runtime, so only a single flag is tracked
+static bool dirty = true;
+
+static void vmem_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write) dirty = true;
+}
+
+static inline bool screen_dirty() {
+  return dirty;
+}
+
+static inline void mark_dirty(int x, int y, int w, int h) {
+  dirty = true;
+}
+
 static void init_screen() {}
 
-static inline void update_screen() {
+static inline bool update_screen() {
   io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+  dirty = false;
+  return true;
 }
 #endif
+#else
+static inline bool screen_dirty() { return false; }
+static inline bool update_screen() { return true; }
+#endif
+
+#ifndef CONFIG_TARGET_AM
+/* The headless backend is used on hosts without a display, and is selected
+ * by --video or --frame-hash. Every sync becomes a frame, which is written
+ * to the video file and/or hashed. The format of the video depends on the
+ * file name:
+ *   *.y4m       a YUV4MPEG2 stream in 4:4:4 with BT.601 limited range
+ *   a pattern   one PPM file per frame, e.g. frames/%05d.ppm
+ *   otherwise   a stream of concatenated PPM frames (image2pipe of ffmpeg)
+ * The hash is 64-bit FNV-1a over the B, G and R bytes of every pixel, one
+ * line per frame.
+ */
+static char *video_file = NULL;
+static char *hash_file = NULL;
+static FILE *video_fp = NULL;
+static FILE *hash_fp = NULL;
+static enum { VIDEO_NONE, VIDEO_Y4M, VIDEO_PPM_FILES, VIDEO_PPM_STREAM } video_fmt = VIDEO_NONE;
+static uint64_t nr_frame = 0;
+
+void vga_set_video_file(char *file) { video_file = file; }
+void vga_set_hash_file(char *file) { hash_file = file; }
+
+static inline bool headless() {
+  return video_file != NULL || hash_file != NULL;
+}
+
+static void init_headless() {
+  if (video_file != NULL) {
+    size_t len = strlen(video_file);
+    if (len >= 4 && strcmp(video_file + len - 4, ".y4m") == 0) video_fmt = VIDEO_Y4M;
+    else if (strchr(video_file, '%') != NULL) video_fmt = VIDEO_PPM_FILES;
+    else video_fmt = VIDEO_PPM_STREAM;
+    if (video_fmt != VIDEO_PPM_FILES) {
+      video_fp = fopen(video_file, "wb");
+      Assert(video_fp, "Can not open '%s'", video_file);
+    }
+    if (video_fmt == VIDEO_Y4M) {
+      fprintf(video_fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", SCREEN_W, SCREEN_H, TIMER_HZ);
+    }
+  }
+  if (hash_file != NULL) {
+    hash_fp = fopen(hash_file, "w");
+    Assert(hash_fp, "Can not open '%s'", hash_file);
+  }
+  Log("VGA is headless, video = %s, frame hash = %s",
+      video_file ? video_file : "none", hash_file ? hash_file : "none");
+}
+
+static void write_ppm(FILE *fp, uint32_t *fb) {
+  static uint8_t rgb[SCREEN_W * SCREEN_H * 3];
+  for (int i = 0; i < SCREEN_W * SCREEN_H; i ++) {
+    rgb[i * 3 + 0] = fb[i] >> 16;
+    rgb[i * 3 + 1] = fb[i] >> 8;
+    rgb[i * 3 + 2] = fb[i];
+  }
+  fprintf(fp, "P6\n%d %d\n255\n", SCREEN_W, SCREEN_H);
+  fwrite(rgb, sizeof(rgb), 1, fp);
+}
+
+static void write_y4m(FILE *fp, uint32_t *fb) {
+  static uint8_t yuv[3][SCREEN_W * SCREEN_H];
+  for (int i = 0; i < SCREEN_W * SCREEN_H; i ++) {
+    int r = (fb[i] >> 16) & 0xff, g = (fb[i] >> 8) & 0xff, b = fb[i] & 0xff;
+    yuv[0][i] = ((  66 * r + 129 * g +  25 * b + 128) >> 8) + 16;
+    yuv[1][i] = (( -38 * r -  74 * g + 112 * b + 128) >> 8) + 128;
+    yuv[2][i] = (( 112 * r -  94 * g -  18 * b + 128) >> 8) + 128;
+  }
+  fputs("FRAME\n", fp);
+  fwrite(yuv, sizeof(yuv), 1, fp);
+}
+
+static void headless_frame() {
+  uint32_t *fb = vmem;
+  if (hash_fp != NULL) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int i = 0; i < SCREEN_W * SCREEN_H; i ++) {
+      for (int j = 0; j < 24; j += 8) {
+        hash = (hash ^ ((fb[i] >> j) & 0xff)) * 0x100000001b3ull;
+      }
+    }
+    fprintf(hash_fp, "%" PRIu64 " %016" PRIx64 "\n", nr_frame, hash);
+    fflush(hash_fp);
+  }
+  switch (video_fmt) {
+    case VIDEO_Y4M: write_y4m(video_fp, fb); break;
+    case VIDEO_PPM_STREAM: write_ppm(video_fp, fb); break;
+    case VIDEO_PPM_FILES: {
+      char name[256];
+      snprintf(name, sizeof(name), video_file, (int)nr_frame);
+      FILE *fp = fopen(name, "wb");
+      Assert(fp, "Can not open '%s'", name);
+      write_ppm(fp, fb);
+      fclose(fp);
+      break;
+    }
+    default: break;
+  }
+  if (video_fp != NULL) fflush(video_fp);
+  nr_frame ++;
+}
+#else
+static inline bool headless() { return false; }
+static void init_headless() {}
+static void headless_frame() {}
 #endif
 
+// the 2D accelerator draws to vmem directly, see gpu.c
+uint32_t *vga_framebuffer(int *w, int *h) {
+  *w = screen_width();
+  *h = screen_height();
+  return vmem;
+}
+
+void vga_mark_dirty(int x, int y, int w, int h) {
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, mark_dirty(x, y, w, h));
+}
+
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
   uint32_t sync = vgactl_port_base[1];
   if (sync) {
-    update_screen();
+    if (headless()) headless_frame();
+    else if (screen_dirty() && !update_screen()) return;
     vgactl_port_base[1] = 0;
   }
 }
 
 void init_vga() {
-  vgactl_port_base = (uint32_t *)new_space(8);
+  vgactl_port_base = (uint32_t *)new_space(12);
   vgactl_port_base[0] = (screen_width() << 16) | screen_height();
+  // capabilities, bit 0 tells the guest whether the 2D accelerator exists
+  vgactl_port_base[2] = MUXDEF(CONFIG_HAS_GPU, 1, 0);
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
+  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 12, NULL);
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 12, NULL);
 #endif
 
   vmem = new_space(screen_size());
-  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
+  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(),
+      headless() ? NULL : MUXDEF(CONFIG_VGA_SHOW_SCREEN, vmem_io_handler, NULL));
+  if (headless()) init_headless();
+  else IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
   IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
 }
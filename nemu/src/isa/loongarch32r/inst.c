@@ -19,8 +19,8 @@
 #include <cpu/decode.h>
 
 #define R(i) gpr(i)
-#define Mr vaddr_read
-#define Mw vaddr_write
+#define Mr(addr, len) (PERF_INC(load), vaddr_read(addr, len))
+#define Mw(addr, len, data) (PERF_INC(store), vaddr_write(addr, len, data))
 
 enum {
   TYPE_2RI12, TYPE_1RI20,
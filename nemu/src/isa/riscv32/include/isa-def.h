@@ -18,17 +18,11 @@
 
 #include <common.h>
 
-typedef struct {
-  word_t mtvec;
-	word_t mepc;
-	word_t mstatus;
-	word_t mcause;
-} CSRs;
-
 typedef struct {
   word_t gpr[MUXDEF(CONFIG_RVE, 16, 32)];
   vaddr_t pc;
-  CSRs csrs;
+  word_t csr[4096];  // indexed by CSR number, see system/csr.c
+  int mode;          // current privilege mode
 } MUXDEF(CONFIG_RV64, riscv64_CPU_state, riscv32_CPU_state);
 
 // decode
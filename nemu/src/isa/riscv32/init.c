@@ -15,6 +15,7 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include "local-include/reg.h"
 
 // this is not consistent with uint8_t
 // but it is ok since we do not access the array directly
@@ -32,6 +33,9 @@ static void restart() {
 
   /* The zero register is always 0. */
   cpu.gpr[0] = 0;
+
+  /* Start in M-mode with the reset values of CSRs. */
+  init_csr();
 }
 
 void init_isa() {
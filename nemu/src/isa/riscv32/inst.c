@@ -18,10 +18,11 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <cpu/difftest.h>
 
 #define R(i) gpr(i)
-#define Mr vaddr_read
-#define Mw vaddr_write
+#define Mr(addr, len) (PERF_INC(load), vaddr_read(addr, len))
+#define Mw(addr, len, data) (PERF_INC(store), vaddr_write(addr, len, data))
 
 enum {
   TYPE_I, TYPE_U, TYPE_S, TYPE_J, TYPE_R, TYPE_B,
@@ -53,6 +54,27 @@ static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_
   }
 }
 
+#define ILLEGAL(s) (s->dnpc = isa_raise_intr(EXC_ILLEGAL_INST, s->pc))
+
+enum { CSR_OP_W, CSR_OP_S, CSR_OP_C };
+
+/* csrrw does not read the CSR if rd = x0, and csrrs/csrrc do not write it
+ * if rs1 = x0 (or uimm = 0), so that the side effects are not triggered.
+ */
+static void csrrx(Decode *s, int rd, word_t imm, word_t src, int op) {
+  int id = BITS(imm, 11, 0);
+  bool is_read = (op != CSR_OP_W || rd != 0);
+  bool is_write = (op == CSR_OP_W || BITS(s->isa.inst, 19, 15) != 0);
+  // guests probe for CSRs, so an unimplemented one traps as well
+  if (csr_check(id, is_write) != CSR_OK) { ILLEGAL(s); return; }
+  if (csr_differs_from_ref(id)) difftest_skip_ref();
+  word_t old = (is_read ? csr_read(id) : 0);
+  if (is_write) {
+    csr_write(id, op == CSR_OP_W ? src : (op == CSR_OP_S ? (old | src) : (old & ~src)));
+  }
+  R(rd) = old;
+}
+
 void ftrace_call(paddr_t pc, paddr_t target);
 void ftrace_ret(paddr_t pc);
 
@@ -65,6 +87,10 @@ static int decode_exec(Decode *s) {
   word_t src1 = 0, src2 = 0, imm = 0; \
   decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
   __VA_ARGS__ ; \
+  IFDEF(CONFIG_PERF_COUNTER, if (concat(TYPE_, type) == TYPE_B) { \
+    if (s->dnpc != s->snpc) PERF_INC(branch_taken); else PERF_INC(branch_untaken); \
+  }) \
+  IFDEF(CONFIG_UARCH_SIM, if (concat(TYPE_, type) == TYPE_B) uarch_branch(s->pc, s->dnpc != s->snpc)); \
 }
 
   INSTPAT_START();
@@ -95,9 +121,17 @@ static int decode_exec(Decode *s) {
     if (s->isa.inst == 0x00008067) ftrace_ret(s->pc);
   }));
 
-  INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw  , I, R(rd) = read_csr(imm); write_csr(imm, src1));
-  INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs  , I, word_t tmp = read_csr(imm); R(rd) = tmp; write_csr(imm, tmp&(~src1)));
-  INSTPAT("0011000 00010 00000 000 00000 11100 11", mret   , I, s->dnpc = read_csr(CSR_MEPC));
+  INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw  , I, csrrx(s, rd, imm, src1, CSR_OP_W));
+  INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs  , I, csrrx(s, rd, imm, src1, CSR_OP_S));
+  INSTPAT("??????? ????? ????? 011 ????? 11100 11", csrrc  , I, csrrx(s, rd, imm, src1, CSR_OP_C));
+  INSTPAT("??????? ????? ????? 101 ????? 11100 11", csrrwi , I, csrrx(s, rd, imm, BITS(s->isa.inst, 19, 15), CSR_OP_W));
+  INSTPAT("??????? ????? ????? 110 ????? 11100 11", csrrsi , I, csrrx(s, rd, imm, BITS(s->isa.inst, 19, 15), CSR_OP_S));
+  INSTPAT("??????? ????? ????? 111 ????? 11100 11", csrrci , I, csrrx(s, rd, imm, BITS(s->isa.inst, 19, 15), CSR_OP_C));
+  INSTPAT("0011000 00010 00000 000 00000 11100 11", mret   , N, if (cpu.mode < PRV_M) ILLEGAL(s); else s->dnpc = isa_mret());
+  INSTPAT("0001000 00010 00000 000 00000 11100 11", sret   , N,
+      if (cpu.mode < PRV_S || (cpu.mode == PRV_S && (csr(CSR_MSTATUS) & MSTATUS_TSR))) ILLEGAL(s); else s->dnpc = isa_sret());
+  INSTPAT("0001000 00101 00000 000 00000 11100 11", wfi    , N, if (cpu.mode == PRV_U) ILLEGAL(s)); // a pending interrupt is taken after it
+  INSTPAT("0001001 ????? ????? 000 00000 11100 11", sfence_vma, N, if (cpu.mode == PRV_U) ILLEGAL(s)); // no TLB
 
   INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, Mw(src1 + imm, 1, SEXT(src2, 8)));
   INSTPAT("??????? ????? ????? 001 ????? 01000 11", sh     , S, Mw(src1 + imm, 2, SEXT(src2, 16)));
@@ -130,7 +164,9 @@ static int decode_exec(Decode *s) {
   INSTPAT("??????? ????? ????? 110 ????? 11000 11", bltu   , B, if (src1 < src2) s->dnpc = s->pc + imm);
   INSTPAT("??????? ????? ????? 111 ????? 11000 11", bgeu   , B, if (src1 >= src2) s->dnpc = s->pc + imm);
 
-  INSTPAT("0000000 00000 00000 000 00000 11100 11", ecall  , N, s->dnpc = isa_raise_intr(11, s->pc));
+  INSTPAT("0000000 00000 00000 000 00000 11100 11", ecall  , N, s->dnpc = isa_raise_intr(EXC_ECALL_U + cpu.mode, s->pc); IFDEF(CONFIG_TRACE_TRIGGER, {
+    if (unlikely(g_trigger_ecall_armed)) trigger_check_ecall(R(MUXDEF(CONFIG_RVE, 15, 17)));
+  }));
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
   INSTPAT_END();
@@ -142,7 +178,5 @@ static int decode_exec(Decode *s) {
 
 int isa_exec_once(Decode *s) {
   s->isa.inst = inst_fetch(&s->snpc, 4);
-  void iringbuf_push(word_t pc, word_t inst);
-  IFDEF(CONFIG_ITRACE, iringbuf_push(s->pc, s->isa.inst));
   return decode_exec(s);
 }
@@ -31,49 +31,72 @@ static inline const char* reg_name(int idx) {
 }
 
 typedef enum {
-	CSR_MSTATUS = 0x300,
-	CSR_MTVEC   = 0x305,
-	CSR_MEPC    = 0x341,
-	CSR_MCAUSE  = 0x342,
+  // supervisor
+  CSR_SSTATUS  = 0x100, CSR_SIE = 0x104, CSR_STVEC = 0x105, CSR_SCOUNTEREN = 0x106,
+  CSR_SSCRATCH = 0x140, CSR_SEPC = 0x141, CSR_SCAUSE = 0x142, CSR_STVAL = 0x143, CSR_SIP = 0x144,
+  CSR_SATP     = 0x180,
+  // machine
+  CSR_MSTATUS  = 0x300, CSR_MISA = 0x301, CSR_MEDELEG = 0x302, CSR_MIDELEG = 0x303,
+  CSR_MIE      = 0x304, CSR_MTVEC = 0x305, CSR_MCOUNTEREN = 0x306,
+  CSR_MSCRATCH = 0x340, CSR_MEPC = 0x341, CSR_MCAUSE = 0x342, CSR_MTVAL = 0x343, CSR_MIP = 0x344,
+  CSR_MVENDORID = 0xf11, CSR_MARCHID = 0xf12, CSR_MIMPID = 0xf13, CSR_MHARTID = 0xf14,
+  // counters
+  CSR_MCYCLE   = 0xb00, // mhpmcounter3.. follow, mcycleh.. are at +0x80 on RV32
+  CSR_CYCLE    = 0xc00, // time, instret and hpmcounter3.. follow, read-only
 } csr_id;
 
-static inline word_t get_csr_val_by_id(int csr_id) {
-  switch (csr_id)
-  {
-  case CSR_MSTATUS:
-    return cpu.csrs.mstatus;
-  case CSR_MTVEC:
-    return cpu.csrs.mtvec;
-  case CSR_MEPC:
-    return cpu.csrs.mepc;
-  case CSR_MCAUSE:
-    return cpu.csrs.mcause;
-  default:
-    panic("unsupported csr id %.8x\n", csr_id);
-  }
-}
+enum { PRV_U = 0, PRV_S = 1, PRV_M = 3 };
 
-static inline void set_csr_val_by_id(int csr_id, word_t val) {
-  switch (csr_id)
-  {
-  case CSR_MSTATUS:
-    cpu.csrs.mstatus = val;
-    break;
-  case CSR_MTVEC:
-    cpu.csrs.mtvec = val;
-    break;
-  case CSR_MEPC:
-    cpu.csrs.mepc = val;
-    break;
-  case CSR_MCAUSE:
-    cpu.csrs.mcause = val;
-    break;
-  default:
-    panic("unsupported csr id %.8x\n", csr_id);
-  }
-}
- 
-#define read_csr(idx) (get_csr_val_by_id(idx)) 
-#define write_csr(idx, val) (set_csr_val_by_id(idx, val))
+#define MSTATUS_SIE  (1u << 1)
+#define MSTATUS_MIE  (1u << 3)
+#define MSTATUS_SPIE (1u << 5)
+#define MSTATUS_MPIE (1u << 7)
+#define MSTATUS_SPP  (1u << 8)
+#define MSTATUS_MPP  (3u << 11)
+#define MSTATUS_MPRV (1u << 17)
+#define MSTATUS_SUM  (1u << 18)
+#define MSTATUS_MXR  (1u << 19)
+#define MSTATUS_TVM  (1u << 20)
+#define MSTATUS_TW   (1u << 21)
+#define MSTATUS_TSR  (1u << 22)
+
+#define MIP_SSIP (1u << 1)
+#define MIP_MSIP (1u << 3)
+#define MIP_STIP (1u << 5)
+#define MIP_MTIP (1u << 7)
+#define MIP_SEIP (1u << 9)
+#define MIP_MEIP (1u << 11)
+
+// the cause of an interrupt is its bit in mip
+enum {
+  IRQ_S_SOFT = 1, IRQ_M_SOFT = 3, IRQ_S_TIMER = 5, IRQ_M_TIMER = 7,
+  IRQ_S_EXT = 9, IRQ_M_EXT = 11,
+};
+#define INTR_BIT ((word_t)1 << (sizeof(word_t) * 8 - 1))
+
+enum {
+  EXC_INST_MISALIGNED = 0, EXC_ILLEGAL_INST = 2, EXC_BREAKPOINT = 3,
+  EXC_ECALL_U = 8, EXC_ECALL_S = 9, EXC_ECALL_M = 11,
+};
+
+// the raw storage, bypassing the masks and the side effects
+#define csr(idx) (cpu.csr[idx])
+
+/* Check an access of the current privilege mode to a CSR. */
+enum { CSR_OK, CSR_NONEXIST, CSR_ILLEGAL };
+int csr_check(int csr_id, bool is_write);
+
+word_t csr_read(int csr_id);
+void csr_write(int csr_id, word_t val);
+bool csr_differs_from_ref(int csr_id);
+const char *csr_name(int csr_id);
+int csr_lookup(const char *name);
+void init_csr();
+
+// the bits of mip driven by the interrupt controllers
+word_t mip_hw();
+
+vaddr_t isa_mret();
+vaddr_t isa_sret();
 
 #endif
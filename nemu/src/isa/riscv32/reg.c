@@ -25,20 +25,41 @@ const char *regs[] = {
 
 void isa_reg_display() {
   for (int i = 0; i < ARRLEN(regs); i++) {
-    printf("%s: 0x%08x %u\n", regs[i], gpr(i), gpr(i));
+    printf("%s: " FMT_WORD " %u\n", regs[i], gpr(i), gpr(i));
   }
-  printf("mstatus: 0x%08x %u\n", cpu.csrs.mstatus, cpu.csrs.mstatus);
-  printf("mtvec: 0x%08x %u\n", cpu.csrs.mtvec, cpu.csrs.mtvec);
-  printf("mcause: 0x%08x %u\n", cpu.csrs.mcause, cpu.csrs.mcause);
-  printf("mepc: 0x%08x %u\n", cpu.csrs.mepc, cpu.csrs.mepc);
+  static const int csrs[] = {
+    CSR_MSTATUS, CSR_MTVEC, CSR_MEPC, CSR_MCAUSE, CSR_MTVAL, CSR_MIE, CSR_MIP,
+    CSR_MEDELEG, CSR_MIDELEG, CSR_STVEC, CSR_SEPC, CSR_SCAUSE, CSR_STVAL, CSR_SATP,
+  };
+  for (int i = 0; i < ARRLEN(csrs); i++) {
+    printf("%s: " FMT_WORD "\n", csr_name(csrs[i]), csr_read(csrs[i]));
+  }
+  printf("mode: %c\n", "USHM"[cpu.mode]);
 }
 
-word_t isa_reg_str2val(const char *s, bool *success) {
+/* The id of a register is its GPR index, REG_ID_PC for the pc, or
+ * REG_ID_CSR plus the number of a CSR.
+ */
+#define REG_ID_PC  32
+#define REG_ID_CSR 64
+
+int isa_reg_str2id(const char *s) {
+  if (strcmp(s, "pc") == 0) return REG_ID_PC;
   for (int i = 0; i < ARRLEN(regs); i++) {
-    if (strcmp(regs[i], s) == 0) {
-      return gpr(i);
-    }
+    if (strcmp(regs[i], s) == 0) return i;
   }
-  *success = false;
-  return 0;
+  int id = csr_lookup(s);
+  return id >= 0 ? REG_ID_CSR + id : -1;
+}
+
+word_t isa_reg_id2val(int id) {
+  if (id < REG_ID_PC) return gpr(id);
+  if (id == REG_ID_PC) return cpu.pc;
+  return csr_read(id - REG_ID_CSR);
+}
+
+word_t isa_reg_str2val(const char *s, bool *success) {
+  int id = isa_reg_str2id(s);
+  if (id < 0) { *success = false; return 0; }
+  return isa_reg_id2val(id);
 }
@@ -0,0 +1,272 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <device/intr.h>
+#include "../local-include/reg.h"
+
+/* Every CSR is described by an entry indexed by its number. A write only
+ * changes the bits in `wmask'. A CSR with a hook is computed from other
+ * state, e.g. sstatus is a view of mstatus, and the hook takes the merged
+ * value. A CSR without a hook lives in cpu.csr[]. The read hooks have no
+ * side effects, since sdb reads CSRs with them as well.
+ */
+
+typedef struct {
+  const char *name;
+  word_t wmask;
+  word_t (*read)(int csr_id);
+  void (*write)(int csr_id, word_t val);
+} CSRDesc;
+
+#define MSTATUS_WMASK (MSTATUS_SIE | MSTATUS_MIE | MSTATUS_SPIE | MSTATUS_MPIE | MSTATUS_SPP | \
+    MSTATUS_MPP | MSTATUS_MPRV | MSTATUS_SUM | MSTATUS_MXR | MSTATUS_TVM | MSTATUS_TW | MSTATUS_TSR)
+#define SSTATUS_MASK  (MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP | MSTATUS_SUM | MSTATUS_MXR)
+#define MEDELEG_WMASK (0xffff & ~(1u << EXC_ECALL_M))
+#define MIDELEG_WMASK 0x222  // SSIP, STIP, SEIP
+#define MIE_WMASK     0xaaa  // SSIE, MSIE, STIE, MTIE, SEIE, MEIE
+#define MIP_WMASK     0x222  // the machine-level bits are set by the devices
+#define SIP_WMASK     0x2    // SSIP
+
+#define MISA_EXT(c) (1u << ((c) - 'A'))
+#define MISA_VALUE (MUXDEF(CONFIG_RV64, 2ull << 62, 1u << 30) | \
+    MISA_EXT('I') | MISA_EXT('M') | MISA_EXT('S') | MISA_EXT('U'))
+
+// ----------- status and interrupt views -----------
+
+static void write_mstatus(int csr_id, word_t val) {
+  // MPP is WARL, and 2 is reserved
+  if ((val & MSTATUS_MPP) == (2u << 11)) val = (val & ~MSTATUS_MPP) | (csr(CSR_MSTATUS) & MSTATUS_MPP);
+  csr(CSR_MSTATUS) = val;
+}
+
+static word_t read_sstatus(int csr_id) {
+  return csr(CSR_MSTATUS) & SSTATUS_MASK;
+}
+
+static void write_sstatus(int csr_id, word_t val) {
+  csr(CSR_MSTATUS) = (csr(CSR_MSTATUS) & ~SSTATUS_MASK) | (val & SSTATUS_MASK);
+}
+
+/* mip only stores the bits written by software, and the bits driven by
+ * the interrupt controllers are merged when it is read.
+ */
+static word_t read_mip(int csr_id) {
+  return csr(CSR_MIP) | mip_hw();
+}
+
+static void write_mip(int csr_id, word_t val) {
+  csr(CSR_MIP) = val & MIP_WMASK;
+}
+
+static word_t read_sie(int csr_id) {
+  return csr(CSR_MIE) & csr(CSR_MIDELEG);
+}
+
+static void write_sie(int csr_id, word_t val) {
+  word_t mask = csr(CSR_MIDELEG);
+  csr(CSR_MIE) = (csr(CSR_MIE) & ~mask) | (val & mask);
+}
+
+static word_t read_sip(int csr_id) {
+  return read_mip(csr_id) & csr(CSR_MIDELEG);
+}
+
+static void write_sip(int csr_id, word_t val) {
+  word_t mask = csr(CSR_MIDELEG) & SIP_WMASK;
+  csr(CSR_MIP) = (csr(CSR_MIP) & ~mask) | (val & mask);
+}
+
+// ----------- counters -----------
+
+/* cycle and instret both count guest instructions, since NEMU does not
+ * model the pipeline. time shadows mtime of the CLINT, or counts
+ * microseconds of the host like the RTC if there is no CLINT.
+ * The hpmcounters expose the performance counters of NEMU:
+ * 3 = loads, 4 = stores, 5 = branches, 6 = taken branches, 7 = traps.
+ * Writing a machine-mode counter only changes its offset.
+ */
+static uint64_t counter_offset[32] = {};
+
+static uint64_t counter_raw(int n) {
+  extern uint64_t g_nr_guest_inst;
+  switch (n) {
+    case 0: case 2: return g_nr_guest_inst;
+    case 1: return MUXDEF(CONFIG_HAS_CLINT, clint_mtime(), get_time());
+#ifdef CONFIG_PERF_COUNTER
+    case 3: return g_perf.load;
+    case 4: return g_perf.store;
+    case 5: return g_perf.branch_taken + g_perf.branch_untaken;
+    case 6: return g_perf.branch_taken;
+    case 7: return g_perf.trap;
+#endif
+    default: return 0;
+  }
+}
+
+static word_t read_counter(int csr_id) {
+  int n = csr_id & 0x1f;
+  uint64_t val = counter_raw(n) + counter_offset[n];
+  return (csr_id & 0x80) ? (word_t)(val >> 32) : (word_t)val;
+}
+
+static void write_counter(int csr_id, word_t val) {
+  int n = csr_id & 0x1f;
+  uint64_t raw = counter_raw(n);
+  uint64_t cur = raw + counter_offset[n];
+  uint64_t new_val;
+  if (csr_id & 0x80) new_val = (cur & 0xffffffffull) | ((uint64_t)val << 32);
+  else new_val = MUXDEF(CONFIG_RV64, val, (cur & ~0xffffffffull) | val);
+  counter_offset[n] = new_val - raw;
+}
+
+// ----------- the table -----------
+
+// the name of a family of CSRs is a format, which takes the low 5 bits of the number
+
+#define PLAIN(n, mask)     { .name = n, .wmask = mask }
+#define VIEW(n, mask, r, w) { .name = n, .wmask = mask, .read = r, .write = w }
+#define COUNTER(n)         VIEW(n, -1, read_counter, write_counter)
+#define RO_COUNTER(n)      VIEW(n, 0, read_counter, NULL)
+
+static const CSRDesc csr_table[4096] = {
+  [CSR_SSTATUS]    = VIEW("sstatus", SSTATUS_MASK, read_sstatus, write_sstatus),
+  [CSR_SIE]        = VIEW("sie", -1, read_sie, write_sie),
+  [CSR_STVEC]      = PLAIN("stvec", ~(word_t)0x2),
+  [CSR_SCOUNTEREN] = PLAIN("scounteren", 0xffffffff),
+  [CSR_SSCRATCH]   = PLAIN("sscratch", -1),
+  [CSR_SEPC]       = PLAIN("sepc", ~(word_t)0x3),
+  [CSR_SCAUSE]     = PLAIN("scause", -1),
+  [CSR_STVAL]      = PLAIN("stval", -1),
+  [CSR_SIP]        = VIEW("sip", -1, read_sip, write_sip),
+  [CSR_SATP]       = PLAIN("satp", -1),
+
+  [CSR_MSTATUS]    = VIEW("mstatus", MSTATUS_WMASK, NULL, write_mstatus),
+  [CSR_MISA]       = PLAIN("misa", 0),
+  [CSR_MEDELEG]    = PLAIN("medeleg", MEDELEG_WMASK),
+  [CSR_MIDELEG]    = PLAIN("mideleg", MIDELEG_WMASK),
+  [CSR_MIE]        = PLAIN("mie", MIE_WMASK),
+  [CSR_MTVEC]      = PLAIN("mtvec", ~(word_t)0x2),
+  [CSR_MCOUNTEREN] = PLAIN("mcounteren", 0xffffffff),
+  [0x323 ... 0x33f] = PLAIN("mhpmevent%d", 0),
+  [CSR_MSCRATCH]   = PLAIN("mscratch", -1),
+  [CSR_MEPC]       = PLAIN("mepc", ~(word_t)0x3),
+  [CSR_MCAUSE]     = PLAIN("mcause", -1),
+  [CSR_MTVAL]      = PLAIN("mtval", -1),
+  [CSR_MIP]        = VIEW("mip", MIP_WMASK, read_mip, write_mip),
+  [CSR_MVENDORID]  = PLAIN("mvendorid", 0),
+  [CSR_MARCHID]    = PLAIN("marchid", 0),
+  [CSR_MIMPID]     = PLAIN("mimpid", 0),
+  [CSR_MHARTID]    = PLAIN("mhartid", 0),
+
+  // there is no machine-mode CSR of time
+  [CSR_MCYCLE]              = COUNTER("mcycle"),
+  [CSR_MCYCLE + 2]          = COUNTER("minstret"),
+  [CSR_MCYCLE + 3 ... CSR_MCYCLE + 31] = COUNTER("mhpmcounter%d"),
+  [CSR_CYCLE]               = RO_COUNTER("cycle"),
+  [CSR_CYCLE + 1]           = RO_COUNTER("time"),
+  [CSR_CYCLE + 2]           = RO_COUNTER("instret"),
+  [CSR_CYCLE + 3 ... CSR_CYCLE + 31] = RO_COUNTER("hpmcounter%d"),
+#ifndef CONFIG_RV64
+  [CSR_MCYCLE + 0x80]       = COUNTER("mcycleh"),
+  [CSR_MCYCLE + 0x82]       = COUNTER("minstreth"),
+  [CSR_MCYCLE + 0x83 ... CSR_MCYCLE + 0x9f] = COUNTER("mhpmcounter%dh"),
+  [CSR_CYCLE + 0x80]        = RO_COUNTER("cycleh"),
+  [CSR_CYCLE + 0x81]        = RO_COUNTER("timeh"),
+  [CSR_CYCLE + 0x82]        = RO_COUNTER("instreth"),
+  [CSR_CYCLE + 0x83 ... CSR_CYCLE + 0x9f] = RO_COUNTER("hpmcounter%dh"),
+#endif
+};
+
+int csr_check(int csr_id, bool is_write) {
+  if (csr_table[csr_id].name == NULL) return CSR_NONEXIST;
+  // bits [9:8] are the lowest privilege mode, and [11:10] = 3 means read-only
+  if (cpu.mode < BITS(csr_id, 9, 8)) return CSR_ILLEGAL;
+  if (is_write && BITS(csr_id, 11, 10) == 3) return CSR_ILLEGAL;
+  if (csr_id == CSR_SATP && cpu.mode == PRV_S && (csr(CSR_MSTATUS) & MSTATUS_TVM)) return CSR_ILLEGAL;
+  if ((csr_id & ~0x9f) == CSR_CYCLE && cpu.mode != PRV_M) {
+    int n = csr_id & 0x1f;
+    if (!BITS(csr(CSR_MCOUNTEREN), n, n)) return CSR_ILLEGAL;
+    if (cpu.mode == PRV_U && !BITS(csr(CSR_SCOUNTEREN), n, n)) return CSR_ILLEGAL;
+  }
+  return CSR_OK;
+}
+
+word_t csr_read(int csr_id) {
+  const CSRDesc *d = &csr_table[csr_id];
+  return d->read ? d->read(csr_id) : csr(csr_id);
+}
+
+void csr_write(int csr_id, word_t val) {
+  const CSRDesc *d = &csr_table[csr_id];
+  if (d->wmask != (word_t)-1) val = (csr_read(csr_id) & ~d->wmask) | (val & d->wmask);
+  if (d->write) d->write(csr_id, val);
+  else if (d->read == NULL) csr(csr_id) = val;
+}
+
+/* The reference design of DiffTest has no interrupt controller and counts
+ * differently, so the instructions which access these values are skipped.
+ */
+bool csr_differs_from_ref(int csr_id) {
+  const CSRDesc *d = &csr_table[csr_id];
+  if (d->read == read_counter) return true;
+  return (d->read == read_mip || d->read == read_sip) && mip_hw() != 0;
+}
+
+// ----------- names -----------
+
+/* The names are expanded once, and sorted for the binary search of sdb,
+ * which looks up a register at every evaluation of an expression.
+ */
+static char names[4096][16];
+static uint16_t sorted[4096];
+static int nr_sorted = 0;
+
+static int cmp_csr(const void *a, const void *b) {
+  return strcmp(names[*(const uint16_t *)a], names[*(const uint16_t *)b]);
+}
+
+static int cmp_name(const void *name, const void *elem) {
+  return strcmp(name, names[*(const uint16_t *)elem]);
+}
+
+static void init_names() {
+  if (nr_sorted > 0) return;
+  for (int i = 0; i < ARRLEN(csr_table); i ++) {
+    if (csr_table[i].name == NULL) continue;
+    snprintf(names[i], sizeof(names[i]), csr_table[i].name, i & 0x1f);
+    sorted[nr_sorted ++] = i;
+  }
+  qsort(sorted, nr_sorted, sizeof(sorted[0]), cmp_csr);
+}
+
+const char *csr_name(int csr_id) {
+  return csr_table[csr_id].name ? names[csr_id] : NULL;
+}
+
+int csr_lookup(const char *name) {
+  const uint16_t *p = bsearch(name, sorted, nr_sorted, sizeof(sorted[0]), cmp_name);
+  return p ? *p : -1;
+}
+
+void init_csr() {
+  init_names();
+  cpu.mode = PRV_M;
+  csr(CSR_MSTATUS) = MSTATUS_MPP;
+  csr(CSR_MISA) = MISA_VALUE;
+  // let the counters be readable in every mode, guests may restrict them
+  csr(CSR_MCOUNTEREN) = 0xffffffff;
+  csr(CSR_SCOUNTEREN) = 0xffffffff;
+}
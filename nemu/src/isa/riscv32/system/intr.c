@@ -14,17 +14,105 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <device/intr.h>
+#include "../local-include/reg.h"
+
+#define MPP_SHIFT 11
+#define SPP_SHIFT 8
+
+// in vectored mode, an interrupt jumps to BASE + 4 * cause
+static word_t trap_vector(word_t tvec, bool is_intr, word_t cause) {
+  word_t base = tvec & ~(word_t)0x3;
+  return (is_intr && (tvec & 0x3) == 1) ? base + 4 * cause : base;
+}
 
 word_t isa_raise_intr(word_t NO, vaddr_t epc) {
-  /* TODO: Trigger an interrupt/exception with ``NO''.
-   * Then return the address of the interrupt/exception vector.
+  IFDEF(CONFIG_PERF_COUNTER, perf_intr(NO));
+  bool is_intr = NO >> (sizeof(word_t) * 8 - 1);
+  word_t cause = NO & ~((word_t)1 << (sizeof(word_t) * 8 - 1));
+  word_t deleg = csr(is_intr ? CSR_MIDELEG : CSR_MEDELEG);
+  word_t status = csr(CSR_MSTATUS);
+
+  /* Traps taken in S-mode or U-mode go to S-mode if they are delegated.
+   * A trap never lowers the privilege mode.
    */
-  cpu.csrs.mepc = epc;
-	cpu.csrs.mcause = NO;
+  if (cpu.mode <= PRV_S && cause < sizeof(word_t) * 8 && ((deleg >> cause) & 1)) {
+    csr(CSR_SEPC) = epc;
+    csr(CSR_SCAUSE) = NO;
+    csr(CSR_STVAL) = 0;
+    status = (status & ~(MSTATUS_SPP | MSTATUS_SPIE | MSTATUS_SIE)) |
+      ((word_t)cpu.mode << SPP_SHIFT) | ((status & MSTATUS_SIE) ? MSTATUS_SPIE : 0);
+    csr(CSR_MSTATUS) = status;
+    cpu.mode = PRV_S;
+    return trap_vector(csr(CSR_STVEC), is_intr, cause);
+  }
 
-  return cpu.csrs.mtvec;
+  csr(CSR_MEPC) = epc;
+  csr(CSR_MCAUSE) = NO;
+  csr(CSR_MTVAL) = 0;
+  status = (status & ~(MSTATUS_MPP | MSTATUS_MPIE | MSTATUS_MIE)) |
+    ((word_t)cpu.mode << MPP_SHIFT) | ((status & MSTATUS_MIE) ? MSTATUS_MPIE : 0);
+  csr(CSR_MSTATUS) = status;
+  cpu.mode = PRV_M;
+  return trap_vector(csr(CSR_MTVEC), is_intr, cause);
 }
 
+vaddr_t isa_mret() {
+  word_t status = csr(CSR_MSTATUS);
+  cpu.mode = (status & MSTATUS_MPP) >> MPP_SHIFT;
+  status = (status & ~(MSTATUS_MPP | MSTATUS_MIE)) | MSTATUS_MPIE |
+    ((status & MSTATUS_MPIE) ? MSTATUS_MIE : 0);
+  // MPRV is cleared when returning to a mode other than M
+  if (cpu.mode != PRV_M) status &= ~MSTATUS_MPRV;
+  csr(CSR_MSTATUS) = status;
+  return csr(CSR_MEPC);
+}
+
+vaddr_t isa_sret() {
+  word_t status = csr(CSR_MSTATUS);
+  cpu.mode = (status & MSTATUS_SPP) >> SPP_SHIFT;
+  status = (status & ~(MSTATUS_SPP | MSTATUS_SIE | MSTATUS_MPRV)) | MSTATUS_SPIE |
+    ((status & MSTATUS_SPIE) ? MSTATUS_SIE : 0);
+  csr(CSR_MSTATUS) = status;
+  return csr(CSR_SEPC);
+}
+
+word_t mip_hw() {
+  word_t mip = 0;
+#ifdef CONFIG_HAS_CLINT
+  if (clint_mtip()) mip |= MIP_MTIP;
+  if (clint_msip()) mip |= MIP_MSIP;
+#endif
+#ifdef CONFIG_HAS_PLIC
+  if (plic_eip(0)) mip |= MIP_MEIP;
+  if (plic_eip(1)) mip |= MIP_SEIP;
+#endif
+  return mip;
+}
+
+// the priority of interrupts to the same mode
+static const int intr_prio[] = { IRQ_M_EXT, IRQ_M_SOFT, IRQ_M_TIMER, IRQ_S_EXT, IRQ_S_SOFT, IRQ_S_TIMER };
+
 word_t isa_query_intr() {
+  // this is checked after every instruction, and most guests enable no interrupt
+  word_t enabled = csr(CSR_MIE);
+  if (likely(enabled == 0)) return INTR_EMPTY;
+  word_t pending = (csr(CSR_MIP) | mip_hw()) & enabled;
+  if (pending == 0) return INTR_EMPTY;
+
+  /* An interrupt to M-mode is taken in a lower mode, or in M-mode with
+   * mstatus.MIE. A delegated one is taken in U-mode, or in S-mode with
+   * mstatus.SIE, but never in M-mode. Interrupts to M-mode go first.
+   */
+  word_t status = csr(CSR_MSTATUS);
+  word_t deleg = csr(CSR_MIDELEG);
+  bool m_on = cpu.mode < PRV_M || (status & MSTATUS_MIE);
+  bool s_on = cpu.mode < PRV_S || (cpu.mode == PRV_S && (status & MSTATUS_SIE));
+  word_t m_pending = m_on ? pending & ~deleg : 0;
+  word_t s_pending = s_on ? pending & deleg : 0;
+  pending = m_pending ? m_pending : s_pending;
+  for (int i = 0; pending != 0 && i < ARRLEN(intr_prio); i ++) {
+    if (pending & (1u << intr_prio[i])) return INTR_BIT | intr_prio[i];
+  }
   return INTR_EMPTY;
 }
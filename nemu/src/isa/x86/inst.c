@@ -119,8 +119,8 @@ static void decode_rm(Decode *s, int *rm_reg, word_t *rm_addr, int *reg, int wid
 
 #define Rr reg_read
 #define Rw reg_write
-#define Mr vaddr_read
-#define Mw vaddr_write
+#define Mr(addr, len) (PERF_INC(load), vaddr_read(addr, len))
+#define Mw(addr, len, data) (PERF_INC(store), vaddr_write(addr, len, data))
 #define RMr(reg, w)  (reg != -1 ? Rr(reg, w) : Mr(addr, w))
 #define RMw(data) do { if (rd != -1) Rw(rd, w, data); else Mw(addr, w, data); } while (0)
 
@@ -59,3 +59,11 @@ void isa_reg_display() {
 word_t isa_reg_str2val(const char *s, bool *success) {
   return 0;
 }
+
+int isa_reg_str2id(const char *s) {
+  return -1;
+}
+
+word_t isa_reg_id2val(int id) {
+  return 0;
+}
@@ -20,9 +20,11 @@ word_t isa_raise_intr(word_t NO, vaddr_t ret_addr) {
   /* TODO: Trigger an interrupt/exception with ``NO''.
    * That is, use ``NO'' to index the IDT.
    */
+  IFDEF(CONFIG_PERF_COUNTER, perf_intr(NO));
 
   return 0;
 }
 
-void query_intr() {
+word_t isa_query_intr() {
+  return INTR_EMPTY;
 }
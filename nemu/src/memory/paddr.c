@@ -16,6 +16,7 @@
 #include <memory/host.h>
 #include <memory/paddr.h>
 #include <device/mmio.h>
+#include <cpu/difftest.h>
 #include <isa.h>
 
 #if   defined(CONFIG_PMEM_MALLOC)
@@ -27,6 +28,10 @@ static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 uint8_t* guest_to_host(paddr_t paddr) { return pmem + paddr - CONFIG_MBASE; }
 paddr_t host_to_guest(uint8_t *haddr) { return haddr - pmem + CONFIG_MBASE; }
 
+void pmem_dma_sync(paddr_t addr, size_t len) {
+  IFDEF(CONFIG_DIFFTEST, if (ref_difftest_memcpy != NULL) ref_difftest_memcpy(addr, guest_to_host(addr), len, DIFFTEST_TO_REF));
+}
+
 static word_t pmem_read(paddr_t addr, int len) {
   word_t ret = host_read(guest_to_host(addr), len);
   return ret;
@@ -36,6 +41,17 @@ static void pmem_write(paddr_t addr, int len, word_t data) {
   host_write(guest_to_host(addr), len, data);
 }
 
+#ifdef CONFIG_WATCHPOINT
+static inline void mem_watch_check(paddr_t addr, int len) {
+  paddr_t off = addr - CONFIG_MBASE;
+  // the access may cross the page boundary
+  if (unlikely(g_mem_watch_page[off >> MEM_WATCH_PAGE_SHIFT] |
+        g_mem_watch_page[(off + len - 1) >> MEM_WATCH_PAGE_SHIFT])) {
+    mem_watch_hit(addr, len);
+  }
+}
+#endif
+
 static void out_of_bound(paddr_t addr) {
   panic("address = " FMT_PADDR " is out of bound of pmem [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
       addr, PMEM_LEFT, PMEM_RIGHT, cpu.pc);
@@ -50,7 +66,7 @@ void init_mem() {
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
-word_t paddr_read(paddr_t addr, int len) {
+static inline word_t __paddr_read(paddr_t addr, int len) {
   IFDEF(CONFIG_MTRACE, printf("pread at " FMT_PADDR " len=%d\n", addr, len));
   if (likely(in_pmem(addr))) return pmem_read(addr, len);
   IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
@@ -58,9 +74,29 @@ word_t paddr_read(paddr_t addr, int len) {
   return 0;
 }
 
+word_t paddr_read(paddr_t addr, int len) {
+  IFDEF(CONFIG_UARCH_SIM, uarch_dcache_access(addr, len, false));
+  return __paddr_read(addr, len);
+}
+
+// instruction fetch goes through the instruction cache in vaddr_ifetch()
+word_t paddr_ifetch(paddr_t addr, int len) {
+  return __paddr_read(addr, len);
+}
+
+// reads of the debugger, which are not seen by the cache model
+word_t paddr_peek(paddr_t addr, int len) {
+  return __paddr_read(addr, len);
+}
+
 void paddr_write(paddr_t addr, int len, word_t data) {
   IFDEF(CONFIG_MTRACE, printf("pwrite at " FMT_PADDR " len=%d, data=" FMT_WORD "\n", addr, len, data));
-  if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
+  IFDEF(CONFIG_UARCH_SIM, uarch_dcache_access(addr, len, true));
+  if (likely(in_pmem(addr))) {
+    pmem_write(addr, len, data);
+    IFDEF(CONFIG_WATCHPOINT, mem_watch_check(addr, len));
+    return;
+  }
   IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
   out_of_bound(addr);
 }
@@ -17,13 +17,18 @@
 #include <memory/paddr.h>
 
 word_t vaddr_ifetch(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  IFDEF(CONFIG_UARCH_SIM, uarch_icache_access(addr, len));
+  return paddr_ifetch(addr, len);
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
   return paddr_read(addr, len);
 }
 
+word_t vaddr_peek(vaddr_t addr, int len) {
+  return paddr_peek(addr, len);
+}
+
 void vaddr_write(vaddr_t addr, int len, word_t data) {
   paddr_write(addr, len, data);
 }
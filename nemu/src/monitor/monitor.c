@@ -15,6 +15,7 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <cpu/cpu.h>
 
 void init_rand();
 void init_log(const char *log_file);
@@ -38,12 +39,24 @@ static void welcome() {
 #include <getopt.h>
 
 void sdb_set_batch_mode();
+void sdb_set_script(char *file);
+bool sdb_reads_stdin();
+void vga_set_video_file(char *file);
+void vga_set_hash_file(char *file);
+void audio_set_wav_file(char *file);
+void disk_set_img_file(char *file);
+void serial_set_input_file(char *file);
 
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *elf_file = NULL;
 static char *img_file = NULL;
 static int difftest_port = 1234;
+static bool serial_stdin = false;
+#ifdef CONFIG_TRACE_TRIGGER
+static char *trigger_specs[16] = {};
+static int nr_trigger_spec = 0;
+#endif
 
 static long load_img() {
   if (img_file == NULL) {
@@ -70,27 +83,83 @@ static long load_img() {
 static int parse_args(int argc, char *argv[]) {
   const struct option table[] = {
     {"batch"    , no_argument      , NULL, 'b'},
+    {"max-inst" , required_argument, NULL, 'n'},
+    {"script"   , required_argument, NULL, 's'},
     {"log"      , required_argument, NULL, 'l'},
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
     {"elf"      , required_argument, NULL, 'e'},
+    {"trigger"  , required_argument, NULL, 't'},
+    {"folded"   , required_argument, NULL, 'F'},
+    {"profile"  , required_argument, NULL, 'P'},
+    {"perf"     , required_argument, NULL, 'j'},
+    {"ring"     , required_argument, NULL, 'r'},
+    {"video"    , required_argument, NULL, 'V'},
+    {"frame-hash", required_argument, NULL, 'H'},
+    {"audio"    , required_argument, NULL, 'A'},
+    {"disk"     , required_argument, NULL, 'D'},
+    {"serial"   , required_argument, NULL, 'S'},
     {"help"     , no_argument      , NULL, 'h'},
     {0          , 0                , NULL,  0 },
   };
   int o;
-  while ( (o = getopt_long(argc, argv, "-bhl:d:p:e:", table, NULL)) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhn:l:d:p:e:t:F:P:j:r:s:V:H:A:D:S:", table, NULL)) != -1) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
+      case 's': sdb_set_script(optarg); break;
+      case 'n': cpu_set_max_inst(strtoull(optarg, NULL, 0)); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
       case 'e': elf_file = optarg; break;
+      case 't':
+#ifdef CONFIG_TRACE_TRIGGER
+        Assert(nr_trigger_spec < ARRLEN(trigger_specs), "Too many triggers, at most %d are supported",
+            (int)ARRLEN(trigger_specs));
+        trigger_specs[nr_trigger_spec ++] = optarg;
+#endif
+        break;
+      case 'F': {
+        void ftrace_set_folded_file(char *file);
+        ftrace_set_folded_file(optarg);
+        break;
+      }
+      case 'P':
+        IFDEF(CONFIG_PROFILER, Assert(profiler_set_interval(optarg), "Invalid profile interval '%s'", optarg));
+        break;
+      case 'j':
+        IFDEF(CONFIG_PERF_COUNTER, perf_set_json_file(optarg));
+        break;
+      case 'r': {
+        void iringbuf_set_dump_file(char *file);
+        IFDEF(CONFIG_IRINGBUF, iringbuf_set_dump_file(optarg));
+        break;
+      }
+      case 'V': IFDEF(CONFIG_HAS_VGA, vga_set_video_file(optarg)); break;
+      case 'H': IFDEF(CONFIG_HAS_VGA, vga_set_hash_file(optarg)); break;
+      case 'A': IFDEF(CONFIG_HAS_AUDIO, audio_set_wav_file(optarg)); break;
+      case 'D': IFDEF(CONFIG_HAS_DISK, disk_set_img_file(optarg)); break;
+      case 'S':
+        IFDEF(CONFIG_SERIAL_INPUT_FIFO, serial_set_input_file(optarg); serial_stdin = (strcmp(optarg, "-") == 0));
+        break;
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
         printf("\t-b,--batch              run with batch mode\n");
+        printf("\t-n,--max-inst=N         abort after N guest instructions\n");
+        printf("\t-s,--script=FILE        run the sdb commands in FILE instead of reading them from stdin\n");
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-e,--elf=ELF_FILE       load ELF file ELF_FILE\n");
+        printf("\t-t,--trigger=SPEC       start/stop tracing on an event, e.g. start:func:main\n");
+        printf("\t-F,--folded=FILE        write folded call stacks of FTRACE to FILE for flamegraph.pl\n");
+        printf("\t-P,--profile=N|Nus      sample the guest PC every N instructions or N us of host CPU time\n");
+        printf("\t-j,--perf=FILE          dump performance counters to FILE in JSON at exit\n");
+        printf("\t-r,--ring=FILE          dump the instruction history to FILE on abort\n");
+        printf("\t-V,--video=FILE         headless VGA, write every frame to FILE (.y4m, PPM stream, or %%05d.ppm)\n");
+        printf("\t-H,--frame-hash=FILE    headless VGA, write the hash of every frame to FILE\n");
+        printf("\t-A,--audio=FILE         write the audio stream to FILE in WAV instead of playing it\n");
+        printf("\t-D,--disk=IMG           use IMG as the disk image instead of CONFIG_DISK_IMG_PATH\n");
+        printf("\t-S,--serial=FILE        read the input of the serial port from FILE, or stdin if FILE is '-' (with -b or -s)\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
         printf("\n");
@@ -105,6 +174,11 @@ void init_monitor(int argc, char *argv[]) {
 
   /* Parse arguments. */
   parse_args(argc, argv);
+  if (serial_stdin && sdb_reads_stdin()) {
+    // readline would race with the serial port for the input
+    printf("--serial=- can only be used with --batch or --script\n");
+    exit(1);
+  }
 
   /* Set random seed. */
   init_rand();
@@ -127,10 +201,15 @@ void init_monitor(int argc, char *argv[]) {
   /* Initialize differential testing. */
   init_difftest(diff_so_file, img_size, difftest_port);
 
-#ifdef CONFIG_FTRACE
   /* Load ELF info to memory. */
   void load_elf(char *elf_file);
   load_elf(elf_file);
+
+#ifdef CONFIG_TRACE_TRIGGER
+  /* Arm the trace triggers. Function names are resolved with the ELF file. */
+  for (int i = 0; i < nr_trigger_spec; i ++) {
+    Assert(trigger_add(trigger_specs[i]), "Invalid trigger '%s'", trigger_specs[i]);
+  }
 #endif
 
   /* Initialize the simple debugger. */
@@ -138,6 +217,12 @@ void init_monitor(int argc, char *argv[]) {
 
   IFDEF(CONFIG_ITRACE, init_disasm());
 
+#ifdef CONFIG_PROFILER
+  /* Start sampling the guest PC. */
+  void init_profiler();
+  init_profiler();
+#endif
+
   /* Display welcome message. */
   welcome();
 }
@@ -0,0 +1,159 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include "sdb.h"
+
+/* The PCs of breakpoints are kept in an open addressing hash set, so
+ * checking one instruction costs a single probe in the common case.
+ * The set is rebuilt whenever a breakpoint is added or deleted.
+ */
+
+typedef struct {
+  int NO;
+  vaddr_t pc;
+  char *desc;
+  Expr *cond;   // stop only if it is true, NULL means always
+  uint64_t hits;
+} BP;
+
+static BP *bps = NULL;
+static int nr_bp_alloc = 0;
+int g_nr_breakpoint = 0;
+static int bp_no = 0;
+
+static vaddr_t *bp_set = NULL;  // PC + 1, 0 means empty
+static uint32_t bp_set_size = 0;
+
+// the breakpoint which stopped the execution is not hit again when resuming
+static bool bp_resuming = false;
+static vaddr_t bp_resume_pc = 0;
+
+static inline uint32_t bp_hash(vaddr_t pc) {
+  return ((uint32_t)pc >> 1) * 2654435761u & (bp_set_size - 1);
+}
+
+static void bp_set_insert(vaddr_t pc) {
+  uint32_t h = bp_hash(pc);
+  while (bp_set[h] != 0 && bp_set[h] != pc + 1) h = (h + 1) & (bp_set_size - 1);
+  bp_set[h] = pc + 1;
+}
+
+static void bp_set_rebuild() {
+  uint32_t size = 16;
+  while (size < g_nr_breakpoint * 2) size *= 2;
+  if (size != bp_set_size) {
+    free(bp_set);
+    bp_set = malloc(sizeof(vaddr_t) * size);
+    assert(bp_set);
+    bp_set_size = size;
+  }
+  memset(bp_set, 0, sizeof(vaddr_t) * bp_set_size);
+  for (int i = 0; i < g_nr_breakpoint; i ++) bp_set_insert(bps[i].pc);
+}
+
+bool breakpoint_check(vaddr_t pc) {
+  if (bp_resuming) {
+    bp_resuming = false;
+    if (pc == bp_resume_pc) return false;
+  }
+  uint32_t h = bp_hash(pc);
+  for (; bp_set[h] != 0; h = (h + 1) & (bp_set_size - 1)) {
+    if (bp_set[h] != pc + 1) continue;
+    bool stop = false;
+    for (int i = 0; i < g_nr_breakpoint; i ++) {
+      if (bps[i].pc != pc) continue;
+      if (bps[i].cond != NULL) {
+        bool success;
+        word_t val = expr_eval(bps[i].cond, &success);
+        if (success && val == 0) continue;
+      }
+      bps[i].hits ++;
+      printf("breakpoint %d: %s at pc = " FMT_WORD "\n", bps[i].NO, bps[i].desc, pc);
+      stop = true;
+    }
+    if (stop) {
+      bp_resuming = true;
+      bp_resume_pc = pc;
+    }
+    return stop;
+  }
+  return false;
+}
+
+void add_bp(char *arg) {
+  bool elf_lookup_func(const char *name, paddr_t *entry);
+  char *desc = strdup(arg);
+  Expr *cond = NULL;
+  char *if_pos = strstr(arg, " if ");
+  if (if_pos != NULL) {
+    *if_pos = '\0';
+    bool success = true;
+    cond = expr_compile(if_pos + 4, &success);
+    if (!success) {
+      printf("invalid condition '%s'\n", if_pos + 4);
+      free(desc);
+      return;
+    }
+  }
+
+  paddr_t entry;
+  vaddr_t pc;
+  if (elf_lookup_func(arg, &entry)) {
+    pc = entry;
+  } else {
+    bool success = true;
+    pc = expr(arg, &success);
+    if (!success) {
+      printf("can not find function or evaluate expression '%s'\n", arg);
+      free(desc);
+      expr_free(cond);
+      return;
+    }
+  }
+
+  if (g_nr_breakpoint == nr_bp_alloc) {
+    nr_bp_alloc = (nr_bp_alloc == 0 ? 16 : nr_bp_alloc * 2);
+    bps = realloc(bps, sizeof(BP) * nr_bp_alloc);
+    assert(bps);
+  }
+  bps[g_nr_breakpoint ++] = (BP) { .NO = bp_no ++, .pc = pc, .desc = desc, .cond = cond, .hits = 0 };
+  bp_set_rebuild();
+  printf("breakpoint added %d: %s at " FMT_WORD "\n", bps[g_nr_breakpoint - 1].NO, desc, pc);
+}
+
+void remove_bp(int NO) {
+  for (int i = 0; i < g_nr_breakpoint; i ++) {
+    if (bps[i].NO != NO) continue;
+    printf("breakpoint removed %d: %s\n", NO, bps[i].desc);
+    free(bps[i].desc);
+    expr_free(bps[i].cond);
+    bps[i] = bps[-- g_nr_breakpoint];
+    bp_set_rebuild();
+    return;
+  }
+  printf("breakpoint %d not found\n", NO);
+}
+
+void breakpoint_display() {
+  if (g_nr_breakpoint == 0) {
+    printf("no breakpoints\n");
+    return;
+  }
+  printf("%-8s%-12s%-10s%s\n", "NO", "PC", "HITS", "WHERE");
+  for (int i = 0; i < g_nr_breakpoint; i ++) {
+    printf("%-8d" FMT_WORD "  %-10" PRIu64 "%s\n", bps[i].NO, bps[i].pc, bps[i].hits, bps[i].desc);
+  }
+}
@@ -14,338 +14,290 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <memory/vaddr.h>
+#include "sdb.h"
 
-/* We use the POSIX regex functions to process regular expressions.
- * Type 'man regex' for more information about POSIX regex functions.
+/* An expression is scanned by a hand-written lexer and parsed by a Pratt
+ * parser in a single pass. The parser emits postfix code, i.e. the AST in
+ * post-order, which is evaluated by a small stack machine. Watchpoints keep
+ * the compiled code, and expr() caches it, so an expression is not parsed
+ * again when it is evaluated many times.
  */
-#include <regex.h>
-#include <memory/vaddr.h>
 
 enum {
-  TK_NOTYPE = 256, TK_NUM, TK_REG,
-  TK_EQ, TK_NQ,
-  TK_AND, TK_OR,
-  TK_NEG, TK_POS, TK_DEREF,
-  TK_LEFT_PARENTHESIS, TK_RIGHT_PARENTHESIS
-};
-
-static int unary_prefix[] = {
+  TK_END = 256, TK_NUM, TK_REG,
   TK_EQ, TK_NQ,
   TK_AND, TK_OR,
-  TK_NEG, TK_POS, TK_DEREF,
-  TK_LEFT_PARENTHESIS
+  TK_NEG, TK_DEREF,
+  OP_AND_JMP, OP_OR_JMP, OP_BOOL, // short-circuit evaluation of && and ||
 };
 
-static int unary_operators[] = {
-  TK_NEG, TK_POS, TK_DEREF,
-};
-
-bool token_in(int token, int tokens[], int len) {
-  for (int i = 0; i < len; i ++) {
-    if (token == tokens[i]) return true;
-  }
-  return false;
-}
-
-static struct rule {
-  const char *regex;
-  int token_type;
-} rules[] = {
-  {" +", TK_NOTYPE},   // spaces
-  {"0x[0-9a-fA-F]+|[[:digit:]]+", TK_NUM},   // number
-  {"\\$[0-9a-zA-Z_]+", TK_REG},   // register
-  {"\\+", '+'},         // plus
-  {"-", '-'},           // minus
-  {"\\*", '*'},         // multiply
-  {"/", '/'},           // divide
-  {"\\(", TK_LEFT_PARENTHESIS},
-  {"\\)", TK_RIGHT_PARENTHESIS},
-  {"==", TK_EQ},        // equal
-  {"!=", TK_NQ},        // not equal
-  {"\\&\\&", TK_AND},       // logical and
-  {"\\|\\|", TK_OR},        // logical or
-};
-
-#define NR_REGEX ARRLEN(rules)
-
-static regex_t re[NR_REGEX] = {};
-
-/* Rules are used for many times.
- * Therefore we compile them only once before any usage.
- */
-void init_regex() {
-  int i;
-  char error_msg[128];
-  int ret;
-
-  for (i = 0; i < NR_REGEX; i ++) {
-    ret = regcomp(&re[i], rules[i].regex, REG_EXTENDED);
-    if (ret != 0) {
-      regerror(ret, &re[i], error_msg, 128);
-      panic("regex compilation failed: %s\n%s", error_msg, rules[i].regex);
-    }
-  }
-}
-
 typedef struct token {
   int type;
-  char str[32];
+  word_t val;       // value of TK_NUM
+  const char *str;  // position in the expression
+  int len;
 } Token;
 
-static Token tokens[32] __attribute__((used)) = {};
-static int nr_token __attribute__((used))  = 0;
-
-static bool make_token(char *e) {
-  int position = 0;
-  int i;
-  regmatch_t pmatch;
+// ----------- lexer -----------
 
-  nr_token = 0;
+static const char *lex_start = NULL;
+static const char *lex_pos = NULL;
+static Token cur;   // the lookahead token
+static bool lex_error = false;
 
-  while (e[position] != '\0') {
-    /* Try all rules one by one. */
-    for (i = 0; i < NR_REGEX; i ++) {
-      if (regexec(&re[i], e + position, 1, &pmatch, 0) == 0 && pmatch.rm_so == 0) {
-        char *substr_start = e + position;
-        int substr_len = pmatch.rm_eo;
-
-        Log("match rules[%d] = \"%s\" at position %d with len %d: %.*s",
-            i, rules[i].regex, position, substr_len, substr_len, substr_start);
-
-        position += substr_len;
+static void syntax_error(const char *pos, const char *msg) {
+  if (lex_error) return;
+  lex_error = true;
+  int off = pos - lex_start;
+  fprintf(stderr, "%s at position %d\n%s\n%*s^\n", msg, off, lex_start, off, "");
+}
 
-        if (rules[i].token_type != TK_NOTYPE && nr_token >= ARRLEN(tokens)) {
-          fprintf(stderr, "too many tokens in one expression\n");
-          return false;
-        }
+static inline bool is_ident(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
 
-        switch (rules[i].token_type) {
-          case '+': case '-': case '*':
-            // recognize unary operator
-            if (nr_token == 0 || token_in(tokens[nr_token-1].type, unary_prefix, ARRLEN(unary_prefix))) {
-              switch (rules[i].token_type)
-              {
-              case '+': tokens[nr_token].type = TK_POS; break;
-              case '-': tokens[nr_token].type = TK_NEG; break;
-              case '*': tokens[nr_token].type = TK_DEREF; break;
-              }
-              nr_token ++;
-              break;
-            }
-            // not unary, passthrough
-          case '/':
-          case TK_LEFT_PARENTHESIS: case TK_RIGHT_PARENTHESIS:
-          case TK_EQ: case TK_NQ: case TK_AND: case TK_OR:
-            // just add to tokens
-            tokens[nr_token].type = rules[i].token_type;
-            nr_token ++;
-            break;
-          case TK_NUM: case TK_REG:
-            // record the str
-            if (substr_len > 31) {
-              fprintf(stderr, "too long token: %.*s\n", substr_len, substr_start);
-              return false;
-            }
-            tokens[nr_token].type = rules[i].token_type;
-            memcpy(tokens[nr_token].str, substr_start, substr_len);
-            tokens[nr_token].str[substr_len] = '\0';
-            nr_token ++;
-            break;
-          default: 
-            // do nothing
+static void next_token() {
+  const char *p = lex_pos;
+  while (*p == ' ' || *p == '\t' || *p == '\n') p ++;
+  cur = (Token) { .type = TK_END, .str = p, .len = 0 };
+
+  char c = *p;
+  if (c == '\0') { lex_pos = p; return; }
+  if (c >= '0' && c <= '9') {
+    char *end;
+    cur.type = TK_NUM;
+    cur.val = strtoull(p, &end, (c == '0' && (p[1] == 'x' || p[1] == 'X')) ? 16 : 10);
+    p = end;
+  } else if (c == '$') {
+    p ++;
+    while (is_ident(*p)) p ++;
+    cur.type = TK_REG;
+    if (p == cur.str + 1) syntax_error(cur.str, "missing register name");
+  } else {
+    int two = (c << 8) | p[1];
+    switch (two) {
+      case ('=' << 8) | '=': cur.type = TK_EQ; p += 2; break;
+      case ('!' << 8) | '=': cur.type = TK_NQ; p += 2; break;
+      case ('&' << 8) | '&': cur.type = TK_AND; p += 2; break;
+      case ('|' << 8) | '|': cur.type = TK_OR; p += 2; break;
+      default:
+        switch (c) {
+          case '+': case '-': case '*': case '/': case '(': case ')':
+            cur.type = c; p ++; break;
+          default:
+            syntax_error(p, "unexpected character");
+            cur.type = TK_END;
             break;
         }
-
-        break;
-      }
-    }
-
-    if (i == NR_REGEX) {
-      fprintf(stderr, "no match at position %d\n%s\n%*.s^\n", position, e, position, "");
-      return false;
     }
   }
-
-  return true;
+  cur.len = p - cur.str;
+  lex_pos = p;
 }
 
+// ----------- parser -----------
 
-word_t eval(int start, int end, bool *success);
-word_t expr(char *e, bool *success) {
-  if (!make_token(e)) {
-    fprintf(stderr, "make token error\n");
-    *success = false;
-    return 0;
-  }
+typedef struct {
+  int type;     // token type or OP_*
+  word_t val;   // value of TK_NUM, register id of TK_REG, or jump target of OP_*_JMP
+} Code;
 
-  *success = true;
-  return eval(0, nr_token-1, success);
-}
+struct Expr {
+  int nr_code;
+  int max_stack;
+  Code code[];
+};
 
-bool check_parentheses(int start, int end, bool *success) {
-  if (tokens[start].type != TK_LEFT_PARENTHESIS) {
-    return false;
+static Code *code_buf = NULL;
+static int nr_code = 0, max_code = 0;
+
+static void emit(int type, word_t val) {
+  if (nr_code == max_code) {
+    max_code = (max_code == 0 ? 64 : max_code * 2);
+    code_buf = realloc(code_buf, sizeof(Code) * max_code);
+    assert(code_buf);
   }
+  code_buf[nr_code ++] = (Code) { .type = type, .val = val };
+}
 
-  if (tokens[end].type != TK_RIGHT_PARENTHESIS) {
-    return false;
+#define PREC_UNARY 7
+
+// binding power of binary operators, 0 for other tokens
+static int infix_prec(int type) {
+  switch (type) {
+    case TK_OR: return 1;
+    case TK_AND: return 2;
+    case TK_EQ: case TK_NQ: return 3;
+    case '+': case '-': return 5;
+    case '*': case '/': return 6;
+    default: return 0;
   }
+}
 
-  int left = 0;
-  for (int i = start; i <= end; i ++) {
-    if (tokens[i].type == TK_LEFT_PARENTHESIS) {
-      left ++;
-    }
-    if (tokens[i].type == TK_RIGHT_PARENTHESIS) {
-      left --;
-    }
-    if (left < 0) {
-      *success = false;
-      return false;
-    }
-    if (left == 0 && i != end) {
-      return false;
+static void parse(int min_prec) {
+  if (lex_error) return;
+  Token t = cur;
+  next_token();
+
+  // prefix
+  switch (t.type) {
+    case TK_NUM: emit(TK_NUM, t.val); break;
+    case TK_REG: {
+      // resolve the register now, the value is read when evaluating
+      char name[32];
+      snprintf(name, sizeof(name), "%.*s", t.len - 1, t.str + 1);
+      int id = (t.len - 1 < sizeof(name) ? isa_reg_str2id(name) : -1);
+      if (id < 0) { syntax_error(t.str, "unknown register"); return; }
+      emit(TK_REG, id);
+      break;
     }
+    case '(':
+      parse(0);
+      if (lex_error) return;
+      if (cur.type != ')') { syntax_error(cur.str, "missing ')'"); return; }
+      next_token();
+      break;
+    case '+': parse(PREC_UNARY); break;
+    case '-': parse(PREC_UNARY); emit(TK_NEG, 0); break;
+    case '*': parse(PREC_UNARY); emit(TK_DEREF, 0); break;
+    default: syntax_error(t.str, t.type == TK_END ? "unexpected end of expression" : "expect an operand"); return;
   }
 
-  if (left != 0) {
-    *success = false;
-    return false;
+  // infix, all binary operators are left associative
+  int prec;
+  while (!lex_error && (prec = infix_prec(cur.type)) > min_prec) {
+    int op = cur.type;
+    next_token();
+    if (op == TK_AND || op == TK_OR) {
+      // skip the right operand if the left one decides the result, as C does
+      int jmp = nr_code;
+      emit(op == TK_AND ? OP_AND_JMP : OP_OR_JMP, 0);
+      parse(prec);
+      emit(OP_BOOL, 0);
+      code_buf[jmp].val = nr_code;
+      continue;
+    }
+    parse(prec);
+    emit(op, 0);
   }
-
-  return true;
 }
 
-int find_main_operator(int start, int end, bool *success);
-word_t eval(int start, int end, bool *success) {
-  // no need to eval due to previous error
-  if (!*success) return 0;
+Expr *expr_compile(char *e, bool *success) {
+  lex_start = lex_pos = e;
+  lex_error = false;
+  nr_code = 0;
+  next_token();
+  parse(0);
+  if (!lex_error && cur.type != TK_END) syntax_error(cur.str, "expect an operator");
 
-  if (start > end) {
-    fprintf(stderr, "start > end, start=%d, end=%d\n", start, end);
+  if (lex_error) {
     *success = false;
-    return 0;
+    return NULL;
   }
+  *success = true;
 
-  if (start == end) {
-    // single token, should be a num or register
-    switch (tokens[start].type) {
-      case TK_NUM:
-        if (tokens[start].str[0] == '0' && tokens[start].str[1] == 'x') {
-          // hex
-          return strtol(tokens[start].str, NULL, 16);
-        }
-        // decimal
-        return strtol(tokens[start].str, NULL, 10);
-      case TK_REG:
-        return isa_reg_str2val(tokens[start].str+1, success);
+  Expr *ex = malloc(sizeof(Expr) + sizeof(Code) * nr_code);
+  assert(ex);
+  ex->nr_code = nr_code;
+  memcpy(ex->code, code_buf, sizeof(Code) * nr_code);
+  // the depth of the stack
+  int depth = 0;
+  ex->max_stack = 0;
+  for (int i = 0; i < nr_code; i ++) {
+    switch (ex->code[i].type) {
+      case TK_NUM: case TK_REG: depth ++; break;
+      case TK_NEG: case TK_DEREF: case OP_BOOL: break;
+      default: depth --; break;
     }
-    fprintf(stderr, "unsupported single token: %s\n", tokens[start].str);
-    *success = false;
-    return 0;
-  }
-  
-  if (check_parentheses(start, end, success)) {
-    // just drop the parentheses
-    return eval(start+1, end-1, success);
-  }
-
-  // no need to eval due to previous error
-  if (!*success) {
-    fprintf(stderr, "check_parentheses error, start=%d, end=%d\n", start, end);
-    return 0;
+    if (depth > ex->max_stack) ex->max_stack = depth;
   }
+  return ex;
+}
 
-  // eval recursively
-  int op = find_main_operator(start, end, success);
-  if (!*success) {
-    fprintf(stderr, "find_main_operator error, start=%d, end=%d\n", start, end);
-    return 0;
-  }
+// check whether the expression is `*ADDR' with a constant ADDR
+bool expr_const_deref(Expr *ex, word_t *addr) {
+  if (ex->nr_code != 2 || ex->code[0].type != TK_NUM || ex->code[1].type != TK_DEREF) return false;
+  *addr = ex->code[0].val;
+  return true;
+}
 
-  // unary
-  if (token_in(tokens[op].type, unary_operators, ARRLEN(unary_operators))) {
-    word_t val2 = eval(op+1, end, success); if (!*success) return 0;
-    switch (tokens[op].type) {
-      case TK_POS: return val2;
-      case TK_NEG: return -val2;
-      case TK_DEREF: return vaddr_read(val2, 4);
-      default: fprintf(stderr, "Unsupported operator: %c\n", tokens[op].type);
-    }
-  }
-  word_t val1 = eval(start, op-1, success); if (!*success) return 0;
-  word_t val2 = eval(op+1, end, success); if (!*success) return 0;
-  switch (tokens[op].type) {
-    case '+':
-      return val1 + val2;
-    case '-':
-      return val1 - val2;
-    case '*':
-      return val1 * val2;
-    case '/':
-      return (sword_t) val1 / (sword_t) val2;
-    case TK_AND:
-      return val1 && val2;
-    case TK_OR:
-      return val1 || val2;
-    case TK_EQ:
-      return val1 == val2;
-    case TK_NQ:
-      return val1 != val2;
-  }
-  fprintf(stderr, "Unsupported operator: %c\n", tokens[op].type);
-  *success = false;
-  return 0;
+void expr_free(Expr *ex) {
+  free(ex);
 }
 
-static struct {
-  int op;
-  int priority;
-} operatorPriority[] = {
-  {TK_OR, 1},
-  {TK_AND, 2},
-  {TK_EQ, 3},
-  {TK_NQ, 3},
-  {'+', 5},
-  {'-', 5},
-  {'*', 6},
-  {'/', 6},
-  {TK_POS, 7},
-  {TK_NEG, 7},
-  {TK_DEREF, 7},
-};
+// ----------- evaluator -----------
 
-int find_main_operator(int start, int end, bool *success) {
-  int pos = -1;
-  int posPriority = -1;
-  int parentheses = 0;
-  for (int i = start; i <= end; i ++) {
-    if (tokens[i].type == TK_LEFT_PARENTHESIS) {
-      parentheses ++;
-      continue;
-    }
-    if (tokens[i].type == TK_RIGHT_PARENTHESIS) {
-      parentheses --;
-      continue;
+word_t expr_eval(Expr *ex, bool *success) {
+  word_t stack[ex->max_stack];
+  int top = 0;
+  *success = true;
+  for (int i = 0; i < ex->nr_code; i ++) {
+    Code *c = &ex->code[i];
+    switch (c->type) {
+      case TK_NUM: stack[top ++] = c->val; continue;
+      case TK_REG: stack[top ++] = isa_reg_id2val(c->val); continue;
+      case TK_NEG: stack[top - 1] = -stack[top - 1]; continue;
+      case TK_DEREF: stack[top - 1] = vaddr_peek(stack[top - 1], 4); continue;
+      case OP_AND_JMP:
+        if (stack[top - 1] == 0) { i = c->val - 1; continue; }
+        top --;
+        continue;
+      case OP_OR_JMP:
+        if (stack[top - 1] != 0) { stack[top - 1] = 1; i = c->val - 1; continue; }
+        top --;
+        continue;
+      case OP_BOOL: stack[top - 1] = (stack[top - 1] != 0); continue;
     }
-    if (parentheses != 0) continue;
-    int currentPriority = -1;
-    for (int j = 0; j < ARRLEN(operatorPriority); j ++) {
-      if (tokens[i].type == operatorPriority[j].op) {
-        currentPriority = operatorPriority[j].priority;
+    word_t val2 = stack[-- top];
+    word_t val1 = stack[top - 1];
+    word_t res = 0;
+    switch (c->type) {
+      case '+': res = val1 + val2; break;
+      case '-': res = val1 - val2; break;
+      case '*': res = val1 * val2; break;
+      case '/':
+        if (val2 == 0) {
+          fprintf(stderr, "divided by zero\n");
+          *success = false;
+          return 0;
+        }
+        // the most negative value divided by -1 overflows, and gives
+        // the dividend as `div' of RISC-V does instead of SIGFPE
+        res = ((sword_t) val2 == -1 ? -val1 : (word_t)((sword_t) val1 / (sword_t) val2));
         break;
-      }
+      case TK_EQ: res = val1 == val2; break;
+      case TK_NQ: res = val1 != val2; break;
     }
-    if (currentPriority == -1) continue;
-    if (posPriority == -1 || currentPriority <= posPriority) {
-      pos = i;
-      posPriority = currentPriority;
-    }
-  }
-  if (pos == -1) {
-    *success = false;
-    return 0;
+    stack[top - 1] = res;
   }
+  return stack[0];
+}
+
+// ----------- cache -----------
+
+#define NR_EXPR_CACHE 64
+
+static struct {
+  char *str;
+  Expr *ex;
+} expr_cache[NR_EXPR_CACHE] = {};
+
+static uint32_t str_hash(const char *s) {
+  uint32_t h = 2166136261u;
+  for (; *s; s ++) h = (h ^ (uint8_t)*s) * 16777619u;
+  return h;
+}
 
-  return pos;
-}
\ No newline at end of file
+word_t expr(char *e, bool *success) {
+  int idx = str_hash(e) % NR_EXPR_CACHE;
+  if (expr_cache[idx].str == NULL || strcmp(expr_cache[idx].str, e) != 0) {
+    Expr *ex = expr_compile(e, success);
+    if (!*success) return 0;
+    free(expr_cache[idx].str);
+    expr_free(expr_cache[idx].ex);
+    expr_cache[idx].str = strdup(e);
+    expr_cache[idx].ex = ex;
+  }
+  return expr_eval(expr_cache[idx].ex, success);
+}
@@ -18,11 +18,12 @@
 #include <memory/paddr.h>
 #include <readline/readline.h>
 #include <readline/history.h>
+#include <unistd.h>
 #include "sdb.h"
 
 static int is_batch_mode = false;
+static char *script_file = NULL;
 
-void init_regex();
 void init_wp_pool();
 
 /* We use the `readline' library to provide more flexibility to read from stdin. */
@@ -69,14 +70,22 @@ static int cmd_si(char *args) {
 static int cmd_info(char *args) {
   char *arg = strtok(NULL, " ");
   if (arg == NULL) {
-    printf("Usage: info r|w\n");
+    printf("Usage: info r|w" MUXDEF(CONFIG_BREAKPOINT, "|b", "") MUXDEF(CONFIG_PERF_COUNTER, "|perf", "") "\n");
   } else if (strcmp(arg, "r") == 0) {
     // print register statement
     isa_reg_display();
   } else if (strcmp(arg, "w") == 0) {
     watchpoint_display();
+#ifdef CONFIG_BREAKPOINT
+  } else if (strcmp(arg, "b") == 0) {
+    breakpoint_display();
+#endif
+#ifdef CONFIG_PERF_COUNTER
+  } else if (strcmp(arg, "perf") == 0) {
+    perf_display();
+#endif
   } else {
-    printf("Usage: info r|w\n");
+    printf("Usage: info r|w" MUXDEF(CONFIG_BREAKPOINT, "|b", "") MUXDEF(CONFIG_PERF_COUNTER, "|perf", "") "\n");
   }
   return 0;
 }
@@ -88,13 +97,17 @@ static int cmd_x(char *args) {
     return 0;
   }
   int n = strtol(arg, NULL, 10);
-  arg = strtok(NULL, " ");
+  arg = strtok(NULL, "");
   if (arg == NULL) {
     printf("Usage: x N EXPR\n");
     return 0;
   }
   bool success = true;
   word_t result = expr(arg, &success);
+  if (!success) {
+    printf("Invalid expression\n");
+    return 0;
+  }
   int *mem = (int *)guest_to_host(result);
   for (int i = 0; i < n; i ++) {
     printf("0x%08x: %08x\n", result+i*4, mem[i]);
@@ -103,6 +116,10 @@ static int cmd_x(char *args) {
 }
 
 static int cmd_p(char *args) {
+  if (args == NULL) {
+    printf("Usage: p EXPR\n");
+    return 0;
+  }
   bool success = true;
   word_t result = expr(args, &success);
   if (!success) {
@@ -114,13 +131,52 @@ static int cmd_p(char *args) {
 }
 
 static int cmd_w(char *args) {
+  if (args == NULL) {
+    printf("Usage: w EXPR\n");
+    return 0;
+  }
   bool success = true;
-  word_t result = expr(args, &success);
+  Expr *code = expr_compile(args, &success);
+  word_t result = (success ? expr_eval(code, &success) : 0);
+  if (!success) {
+    printf("Invalid expression\n");
+    expr_free(code);
+    return 0;
+  }
+  // `*ADDR' can only be changed by a store, watch the memory instead, but
+  // stop only when the value changes, like other watchpoints. Stores made
+  // by DMA devices are missed then.
+  word_t addr;
+  if (expr_const_deref(code, &addr) && in_pmem(addr) && in_pmem(addr + 3)) {
+    expr_free(code);
+    add_mem_wp(args, addr, 4, true);
+    return 0;
+  }
+  add_wp(args, code, result);
+  return 0;
+}
+
+static int cmd_wm(char *args) {
+  char *arg = strtok(NULL, " ");
+  char *e = strtok(NULL, "");
+  if (arg == NULL || e == NULL) {
+    printf("Usage: wm N EXPR\n");
+    return 0;
+  }
+  int n = strtol(arg, NULL, 10);
+  if (n != 1 && n != 2 && n != 4 && n != 8) {
+    printf("N must be 1, 2, 4 or 8\n");
+    return 0;
+  }
+  bool success = true;
+  word_t addr = expr(e, &success);
   if (!success) {
     printf("Invalid expression\n");
     return 0;
   }
-  add_wp(args, result);
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%d@" FMT_PADDR, n, (paddr_t)addr);
+  add_mem_wp(buf, addr, n, false);
   return 0;
 }
 
@@ -135,6 +191,141 @@ static int cmd_d(char *args) {
   return 0;
 }
 
+#ifdef CONFIG_BREAKPOINT
+static int cmd_b(char *args) {
+  if (args == NULL) breakpoint_display();
+  else add_bp(args);
+  return 0;
+}
+
+static int cmd_bd(char *args) {
+  char *arg = strtok(NULL, "");
+  if (!arg) {
+    printf("Usage: bd N\n");
+    return 0;
+  }
+  remove_bp(strtol(arg, NULL, 10));
+  return 0;
+}
+#endif
+
+#ifdef CONFIG_TRACE_TRIGGER
+static int cmd_trigger(char *args) {
+  if (args == NULL) trigger_display();
+  else trigger_add(args);
+  return 0;
+}
+#endif
+
+/* Check and measure the expression evaluator with the output of
+ * tools/gen-expr, in which each line is `RESULT EXPR'.
+ */
+static int cmd_bench_expr(char *args) {
+  char *file = strtok(NULL, " ");
+  char *arg = strtok(NULL, " ");
+  if (file == NULL) {
+    printf("Usage: bench-expr FILE [N]\n");
+    return 0;
+  }
+  int rounds = (arg == NULL ? 100 : strtol(arg, NULL, 10));
+  if (rounds <= 0) rounds = 1;
+  FILE *fp = fopen(file, "r");
+  if (fp == NULL) {
+    perror(file);
+    return 0;
+  }
+
+  int nr_exp = 0, max_exp = 0;
+  char **exps = NULL;
+  uint32_t *results = NULL;
+  size_t total_len = 0;
+  char *line = NULL;
+  size_t line_size = 0;
+  while (getline(&line, &line_size, fp) != -1) {
+    uint32_t res;
+    int n;
+    if (sscanf(line, "%u%n", &res, &n) != 1) continue;
+    line[strcspn(line, "\n")] = '\0';
+    if (nr_exp == max_exp) {
+      max_exp = (max_exp == 0 ? 1024 : max_exp * 2);
+      exps = realloc(exps, sizeof(char *) * max_exp);
+      results = realloc(results, sizeof(uint32_t) * max_exp);
+      assert(exps && results);
+    }
+    exps[nr_exp] = strdup(line + n);
+    results[nr_exp ++] = res;
+    total_len += strlen(line + n);
+  }
+  free(line);
+  fclose(fp);
+  if (nr_exp == 0) {
+    printf("no expressions in %s\n", file);
+    return 0;
+  }
+
+  // check the results, and keep the compiled code for evaluation
+  Expr **codes = malloc(sizeof(Expr *) * nr_exp);
+  assert(codes);
+  int nr_fail = 0;
+  for (int i = 0; i < nr_exp; i ++) {
+    bool success = true;
+    codes[i] = expr_compile(exps[i], &success);
+    word_t res = (success ? expr_eval(codes[i], &success) : 0);
+    if (!success || (uint32_t)res != results[i]) {
+      if (nr_fail ++ < 10) printf("FAIL: %s\nexpected: %u, got: %u\n", exps[i], results[i], (uint32_t)res);
+    }
+  }
+  printf("%d/%d expressions passed\n", nr_exp - nr_fail, nr_exp);
+
+  uint64_t start = get_time();
+  for (int r = 0; r < rounds; r ++) {
+    for (int i = 0; i < nr_exp; i ++) {
+      bool success;
+      expr_free(expr_compile(exps[i], &success));
+    }
+  }
+  uint64_t parse_time = get_time() - start;
+
+  start = get_time();
+  for (int r = 0; r < rounds; r ++) {
+    for (int i = 0; i < nr_exp; i ++) {
+      bool success;
+      if (codes[i] != NULL) expr_eval(codes[i], &success);
+    }
+  }
+  uint64_t eval_time = get_time() - start;
+
+  double n = (double)nr_exp * rounds;
+  if (parse_time == 0) parse_time = 1;
+  if (eval_time == 0) eval_time = 1;
+  printf("parse: %.0f expr/s, %.2f MB/s\n", n * 1e6 / parse_time, total_len * (double)rounds / parse_time);
+  printf("eval:  %.0f expr/s\n", n * 1e6 / eval_time);
+
+  for (int i = 0; i < nr_exp; i ++) {
+    expr_free(codes[i]);
+    free(exps[i]);
+  }
+  free(codes);
+  free(exps);
+  free(results);
+  return 0;
+}
+
+static int run_script(const char *file);
+
+static int cmd_source(char *args) {
+  if (args == NULL) {
+    printf("Usage: source FILE\n");
+    return 0;
+  }
+  return run_script(args);
+}
+
+static int cmd_echo(char *args) {
+  printf("%s\n", args == NULL ? "" : args);
+  return 0;
+}
+
 static int cmd_help(char *args);
 
 static struct {
@@ -146,11 +337,22 @@ static struct {
   { "c", "Continue the execution of the program", cmd_c },
   { "q", "Exit NEMU", cmd_q },
   { "si", "si [N]: Step through N(default 1) instruction(s)", cmd_si },
-  { "info", "info r|w: Print register state(r) or watchpoint information(w)", cmd_info },
+  { "info", "info r|w|b|perf: Print register state(r), watchpoint(w) or breakpoint(b) information, or performance counters(perf)", cmd_info },
   { "x", "x N EXPR: Print N 4-byte values after address EXPR", cmd_x },
   { "p", "p EXPR: Calculate and print the value of EXPR", cmd_p },
   { "w", "w EXPR: Set a watchpoint on the value of EXPR", cmd_w },
-  { "d", "d N: Delete watchpoint N", cmd_d }
+  { "wm", "wm N EXPR: Stop when any of the N (1, 2, 4 or 8) bytes after address EXPR is written by the CPU", cmd_wm },
+  { "d", "d N: Delete watchpoint N", cmd_d },
+#ifdef CONFIG_BREAKPOINT
+  { "b", "b [ADDR|SYMBOL [if EXPR]]: Stop before executing the instruction at ADDR or the entry of function SYMBOL (when EXPR is true), or list breakpoints", cmd_b },
+  { "bd", "bd N: Delete breakpoint N", cmd_bd },
+#endif
+  { "source", "source FILE: Execute the commands in FILE", cmd_source },
+  { "echo", "echo TEXT: Print TEXT", cmd_echo },
+  { "bench-expr", "bench-expr FILE [N]: Check the expressions generated by tools/gen-expr in FILE, and measure the throughput of N rounds", cmd_bench_expr },
+#ifdef CONFIG_TRACE_TRIGGER
+  { "trigger", "trigger [start|stop:pc|func|mmio|ecall|count:ARG]: Add a trace trigger, or list them", cmd_trigger },
+#endif
 };
 
 #define NR_CMD ARRLEN(cmd_table)
@@ -182,79 +384,123 @@ void sdb_set_batch_mode() {
   is_batch_mode = true;
 }
 
-void sdb_mainloop() {
-  if (is_batch_mode) {
-    cmd_c(NULL);
-    return;
-  }
+void sdb_set_script(char *file) {
+  script_file = file;
+}
 
-  for (char *str; (str = rl_gets()) != NULL; ) {
-    char *str_end = str + strlen(str);
-
-    /* extract the first token as the command */
-    char *cmd = strtok(str, " ");
-    if (cmd == NULL) { continue; }
-
-    /* treat the remaining string as the arguments,
-     * which may need further parsing
-     */
-    char *args = cmd + strlen(cmd) + 1;
-    if (args >= str_end) {
-      args = NULL;
+bool sdb_reads_stdin() {
+  return !is_batch_mode && script_file == NULL;
+}
+
+/* Execute one command. `CMD > FILE' and `CMD >> FILE' redirect the output
+ * of the command to FILE, since no expression contains `>'.
+ */
+static int sdb_exec(char *str) {
+  FILE *redirect = NULL;
+  int saved_stdout = -1;
+  char *gt = strchr(str, '>');
+  if (gt != NULL) {
+    bool append = (gt[1] == '>');
+    *gt = '\0';
+    char *file = strtok(gt + (append ? 2 : 1), " ");
+    if (file == NULL) {
+      printf("missing file name after '>'\n");
+      return 0;
+    }
+    redirect = fopen(file, append ? "a" : "w");
+    if (redirect == NULL) {
+      perror(file);
+      return 0;
     }
+    fflush(stdout);
+    saved_stdout = dup(STDOUT_FILENO);
+    dup2(fileno(redirect), STDOUT_FILENO);
+  }
+
+  char *str_end = str + strlen(str);
+  int ret = 0;
+
+  /* extract the first token as the command */
+  char *cmd = strtok(str, " ");
+  if (cmd == NULL) { goto done; }
+
+  /* treat the remaining string as the arguments,
+   * which may need further parsing
+   */
+  char *args = cmd + strlen(cmd) + 1;
+  if (args >= str_end) {
+    args = NULL;
+  }
 
 #ifdef CONFIG_DEVICE
-    extern void sdl_clear_event_queue();
-    sdl_clear_event_queue();
+  extern void sdl_clear_event_queue();
+  sdl_clear_event_queue();
 #endif
 
-    int i;
-    for (i = 0; i < NR_CMD; i ++) {
-      if (strcmp(cmd, cmd_table[i].name) == 0) {
-        if (cmd_table[i].handler(args) < 0) { return; }
-        break;
-      }
+  int i;
+  for (i = 0; i < NR_CMD; i ++) {
+    if (strcmp(cmd, cmd_table[i].name) == 0) {
+      ret = cmd_table[i].handler(args);
+      break;
     }
+  }
+
+  if (i == NR_CMD) { printf("Unknown command '%s'\n", cmd); }
 
-    if (i == NR_CMD) { printf("Unknown command '%s'\n", cmd); }
+done:
+  if (redirect != NULL) {
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    fclose(redirect);
   }
+  return ret;
 }
 
-void test_expr() {
-  FILE *fp = fopen("/home/shinya/ics2024/nemu/tools/gen-expr/build/input", "r");
-  if (fp == NULL)
-    perror("test_expr error");
-  
-  word_t correct;
-  char exp[1024];
-  while (fscanf(fp, "%u", &correct) != EOF) {
-    if(fgets(exp, 1024, fp) == NULL) break;
-    // remove the '\n'
-    size_t len = strlen(exp);
-    if (len > 0 && exp[len - 1] == '\n') {
-        exp[len - 1] = '\0';
-    }
-    bool success = true;
-    word_t res = expr(exp, &success);
-    if (res != correct || !success) {
-      puts(exp);
-      printf("expected: %u, got: %u\n", correct, res);
-      assert(0);
+/* Commands in a script are echoed, and empty lines and lines starting
+ * with `#' are skipped.
+ */
+static int run_script(const char *file) {
+  FILE *fp = fopen(file, "r");
+  if (fp == NULL) {
+    perror(file);
+    return 0;
+  }
+  char *line = NULL;
+  size_t size = 0;
+  int ret = 0;
+  while (ret >= 0 && getline(&line, &size, fp) != -1) {
+    line[strcspn(line, "\r\n")] = '\0';
+    char *p = line + strspn(line, " \t");
+    if (*p == '\0' || *p == '#') continue;
+    printf("(nemu) %s\n", p);
+    ret = sdb_exec(p);
+  }
+  free(line);
+  fclose(fp);
+  return ret;
+}
+
+void sdb_mainloop() {
+  if (script_file != NULL) {
+    // keep the state of a finished program for is_exit_status_bad()
+    if (run_script(script_file) >= 0 && nemu_state.state != NEMU_END && nemu_state.state != NEMU_ABORT) {
+      cmd_q(NULL);
     }
+    return;
   }
 
-  fclose(fp);
+  if (is_batch_mode) {
+    cmd_c(NULL);
+    return;
+  }
 
-  Log("pass expr test!");
+  for (char *str; (str = rl_gets()) != NULL; ) {
+    if (sdb_exec(str) < 0) { return; }
+  }
 }
 
 void init_sdb() {
-  /* Compile the regular expressions. */
-  init_regex();
-
-  /* Test decimal expression*/
-  // test_expr();
-
   /* Initialize the watchpoint pool. */
   init_wp_pool();
 }
@@ -18,9 +18,19 @@
 
 #include <common.h>
 
+typedef struct Expr Expr;
+
 word_t expr(char *e, bool *success);
-void add_wp(char *expr, word_t value);
+Expr *expr_compile(char *e, bool *success);
+word_t expr_eval(Expr *ex, bool *success);
+void expr_free(Expr *ex);
+bool expr_const_deref(Expr *ex, word_t *addr);
+void add_wp(char *expr, Expr *code, word_t value);
+bool add_mem_wp(char *expr, paddr_t addr, int len, bool on_change);
 void remove_wp(int NO);
 void watchpoint_display();
+void add_bp(char *arg);
+void remove_bp(int NO);
+void breakpoint_display();
 
 #endif
@@ -13,7 +13,9 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
-#include <string.h>
+#include <isa.h>
+#include <memory/paddr.h>
+#include <memory/host.h>
 #include "sdb.h"
 
 #define NR_WP 32
@@ -22,12 +24,31 @@ typedef struct watchpoint {
   int NO;
   struct watchpoint *next;
   char *expr;
+  Expr *code;   // compiled once when the watchpoint is added, NULL for memory watchpoints
   word_t value;
+  paddr_t addr; // the watched range of memory watchpoints
+  int len;
+  bool on_change; // stop only when a store changes the value, as `w' does
 } WP;
 
 static WP wp_pool[NR_WP] = {};
 static WP *head = NULL, *free_ = NULL;
 
+/* A memory watchpoint is only checked when its pages are written by the
+ * CPU through paddr_write(). Stores made by DMA devices are not seen.
+ */
+uint8_t g_mem_watch_page[(CONFIG_MSIZE >> MEM_WATCH_PAGE_SHIFT) + 1] = {};
+
+static void mark_pages(WP *wp, int delta) {
+  paddr_t first = (wp->addr - CONFIG_MBASE) >> MEM_WATCH_PAGE_SHIFT;
+  paddr_t last = (wp->addr + wp->len - 1 - CONFIG_MBASE) >> MEM_WATCH_PAGE_SHIFT;
+  for (paddr_t p = first; p <= last; p ++) g_mem_watch_page[p] += delta;
+}
+
+static word_t mem_value(WP *wp) {
+  return wp->len <= sizeof(word_t) ? host_read(guest_to_host(wp->addr), wp->len) : 0;
+}
+
 void init_wp_pool() {
   int i;
   for (i = 0; i < NR_WP; i ++) {
@@ -51,38 +72,64 @@ static WP* new_wp() {
   return wp;
 }
 
-static void free_wp(WP *wp) {
+static bool free_wp(WP *wp) {
   WP* tmp = head;
   if (tmp == wp) {
-    head = NULL;
+    head = wp->next;
   } else {
     while (tmp != NULL && tmp->next != wp) tmp = tmp->next;
     if (tmp == NULL) {
       fprintf(stderr, "watchpoint %d not in use\n", wp->NO);
-      return;
+      return false;
     }
     tmp->next = wp->next;
   }
   wp->next = free_;
   free_ = wp;
+  return true;
 }
 
-void add_wp(char *expr, word_t value) {
+void add_wp(char *expr, Expr *code, word_t value) {
   WP *wp = new_wp();
-  if (wp == NULL) return;
+  if (wp == NULL) { expr_free(code); return; }
   wp->expr = strdup(expr);
+  wp->code = code;
   wp->value = value;
   printf("watchpoint added %d: %s\n", wp->NO, expr);
 }
 
+bool add_mem_wp(char *expr, paddr_t addr, int len, bool on_change) {
+  if (len <= 0 || !in_pmem(addr) || !in_pmem(addr + len - 1)) {
+    printf("memory watchpoints only support ranges inside pmem\n");
+    return false;
+  }
+  WP *wp = new_wp();
+  if (wp == NULL) return false;
+  wp->expr = strdup(expr);
+  wp->code = NULL;
+  wp->addr = addr;
+  wp->len = len;
+  wp->on_change = on_change;
+  wp->value = mem_value(wp);
+  mark_pages(wp, 1);
+  printf("memory watchpoint added %d: %s, [" FMT_PADDR ", " FMT_PADDR "]\n",
+      wp->NO, expr, addr, addr + len - 1);
+  return true;
+}
+
 void remove_wp(int NO) {
-  if (NO >= NR_WP) {
+  if (NO < 0 || NO >= NR_WP) {
     fprintf(stderr, "watchpoint %d not found\n", NO);
     return;
   }
   WP *wp = &wp_pool[NO];
-  free_wp(wp);
+  if (!free_wp(wp)) return;
   printf("watchpoint removed %d: %s\n", NO, wp->expr);
+  if (wp->code == NULL) mark_pages(wp, -1);
+  free(wp->expr);
+  expr_free(wp->code);
+  wp->expr = NULL;
+  wp->code = NULL;
 }
 
 void watchpoint_display() {
@@ -93,7 +140,8 @@ void watchpoint_display() {
   }
   printf("%-8s%-8s\n", "NO", "EXPR");
   while (wp != NULL) {
-    printf("%-8d%-8s\n", wp->NO, wp->expr);
+    if (wp->code == NULL) printf("%-8d%-8s (memory, %d bytes)\n", wp->NO, wp->expr, wp->len);
+    else printf("%-8d%-8s\n", wp->NO, wp->expr);
     wp = wp->next;
   }
 }
@@ -101,8 +149,9 @@ void watchpoint_display() {
 void difftest_wp() {
   WP *wp = head;
   while (wp != NULL) {
+    if (wp->code == NULL) { wp = wp->next; continue; }
     bool _;
-    word_t result = expr(wp->expr, &_);
+    word_t result = expr_eval(wp->code, &_);
     if (result != wp->value) {
       printf("watchpoint %d: %s triggered: \nold = 0x%08x\nnew = 0x%08x\n", wp->NO, wp->expr, wp->value, result);
       wp->value = result;
@@ -111,4 +160,18 @@ void difftest_wp() {
     }
     wp = wp->next;
   }
-}
\ No newline at end of file
+}
+void mem_watch_hit(paddr_t addr, int len) {
+  for (WP *wp = head; wp != NULL; wp = wp->next) {
+    if (wp->code != NULL || addr > wp->addr + wp->len - 1 || addr + len - 1 < wp->addr) continue;
+    word_t value = mem_value(wp);
+    if (wp->on_change && value == wp->value) continue;
+    printf("watchpoint %d: %s written at pc = " FMT_WORD "\n", wp->NO, wp->expr, cpu.pc);
+    if (wp->len <= sizeof(word_t)) {
+      printf("old = " FMT_WORD "\nnew = " FMT_WORD "\n", wp->value, value);
+      wp->value = value;
+    }
+    nemu_state.state = NEMU_STOP;
+    return;
+  }
+}
@@ -4,11 +4,18 @@
 struct func_info {
     paddr_t entry;
     uint32_t size;
-    char func_name[32];
-    struct func_info *next;
+    char *func_name;
 };
 
-struct func_info *func_list = NULL;
+// sorted by entry, looked up with binary search
+static struct func_info *func_table = NULL;
+static int nr_func = 0;
+
+static int func_cmp(const void *a, const void *b) {
+    const struct func_info *fa = a, *fb = b;
+    if (fa->entry != fb->entry) return fa->entry < fb->entry ? -1 : 1;
+    return 0;
+}
 
 static void parse_func_table(Elf32_Ehdr *ehdr) {
     // section header table
@@ -26,19 +33,22 @@ static void parse_func_table(Elf32_Ehdr *ehdr) {
 
     Elf32_Sym *symbol_table = (Elf32_Sym *)((uint8_t *)ehdr + symbol_table_section->sh_offset);
     char *string_table = (char *)ehdr + string_table_section->sh_offset;
+    int nr_symbol = symbol_table_section->sh_size / symbol_table_section->sh_entsize;
 
-    for (int i = 0; i < symbol_table_section->sh_size / symbol_table_section->sh_entsize; i ++) {
+    func_table = malloc(sizeof(struct func_info) * nr_symbol);
+    Assert(func_table, "malloc function table error");
+    for (int i = 0; i < nr_symbol; i ++) {
         Elf32_Sym *symbol = &symbol_table[i];
         if (ELF32_ST_TYPE(symbol->st_info) != STT_FUNC) {
             continue;
         }
-        struct func_info *func = malloc(sizeof(struct func_info));
+        struct func_info *func = &func_table[nr_func ++];
         func->entry = symbol->st_value;
         func->size = symbol->st_size;
-        strcpy(func->func_name, string_table + symbol->st_name);
-        func->next = func_list;
-        func_list = func;
+        func->func_name = strdup(string_table + symbol->st_name);
     }
+    qsort(func_table, nr_func, sizeof(struct func_info), func_cmp);
+    Log("%d functions are loaded from the symbol table", nr_func);
 }
 
 void load_elf(char *elf_file) {
@@ -68,47 +78,235 @@ void load_elf(char *elf_file) {
     free(buf);
 }
 
-static char *get_func_name(paddr_t entry, bool range) {
-    struct func_info *func = func_list;
-    while (func) {
-        if (!range && func->entry == entry) {
-            return func->func_name;
-        }
-        if (range && func->entry <= entry && func->entry + func->size > entry) {
-            return func->func_name;
+// return the index of the function containing `addr`, or -1
+static int find_func(paddr_t addr) {
+    int lo = 0, hi = nr_func - 1, found = -1;
+    // find the last function whose entry <= addr
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (func_table[mid].entry <= addr) { found = mid; lo = mid + 1; }
+        else hi = mid - 1;
+    }
+    if (found == -1) return -1;
+    // the function at `found` may be an alias with zero size, check the neighbours
+    for (int i = found; i >= 0 && func_table[i].entry == func_table[found].entry; i --) {
+        if (addr == func_table[i].entry || addr - func_table[i].entry < func_table[i].size) return i;
+    }
+    return -1;
+}
+
+const char *elf_func_name(paddr_t addr) {
+    int idx = find_func(addr);
+    return idx == -1 ? NULL : func_table[idx].func_name;
+}
+
+bool elf_lookup_func(const char *name, paddr_t *entry) {
+    for (int i = 0; i < nr_func; i ++) {
+        if (strcmp(func_table[i].func_name, name) == 0) {
+            *entry = func_table[i].entry;
+            return true;
         }
-        func = func->next;
     }
-    return "???";
+    return false;
 }
 
-int call_depth = 0;
-void ftrace_call(paddr_t pc, paddr_t target) {
-    if (func_list == NULL) return;
+static char *get_func_name(int idx) {
+    return idx == -1 ? "???" : func_table[idx].func_name;
+}
+
+// ----------- call profiler -----------
+
+/* Every call pushes a frame to the shadow call stack, and every return pops
+ * one. A tail call reuses the frame of its caller, so popping exactly one
+ * frame per return keeps the stack balanced. The frames form a calling
+ * context tree, whose nodes accumulate the exclusive guest instructions of
+ * each call path. It is dumped in the folded-stack format of flamegraph.pl.
+ */
+
+#define MAX_CALL_DEPTH 4096
+
+struct call_node {
+    int parent;
+    int func;
+    uint64_t self;  // exclusive guest instructions on this call path
+};
+
+struct call_frame {
+    int node;
+    uint64_t enter; // g_nr_guest_inst when entering
+    uint64_t child; // inclusive instructions spent in callees
+};
+
+struct func_stat {
+    uint64_t calls;
+    uint64_t inclusive;
+    uint64_t exclusive;
+    int active;     // number of frames on the stack, to avoid counting recursion twice
+};
+
+extern uint64_t g_nr_guest_inst;
+
+static struct call_node *nodes = NULL;
+static int nr_node = 0, max_node = 0;
+static int *node_hash = NULL; // node index + 1, 0 means empty
+static int hash_size = 0;
+
+static struct call_frame call_stack[MAX_CALL_DEPTH];
+static int call_depth = 0;    // may exceed MAX_CALL_DEPTH, frames beyond it are not recorded
+
+static struct func_stat *func_stats = NULL; // the last one is for "???"
+static char *folded_file = NULL;
+
+static inline uint32_t node_hash_idx(int parent, int func) {
+    return ((uint32_t)parent * 2654435761u ^ (uint32_t)(func + 1) * 40503u) & (hash_size - 1);
+}
+
+static void node_hash_insert(int idx) {
+    uint32_t h = node_hash_idx(nodes[idx].parent, nodes[idx].func);
+    while (node_hash[h] != 0) h = (h + 1) & (hash_size - 1);
+    node_hash[h] = idx + 1;
+}
+
+static int new_node(int parent, int func) {
+    if (nr_node == max_node) {
+        max_node = (max_node == 0 ? 1024 : max_node * 2);
+        nodes = realloc(nodes, sizeof(struct call_node) * max_node);
+        assert(nodes);
+    }
+    if (nr_node * 2 >= hash_size) {
+        hash_size = (hash_size == 0 ? 2048 : hash_size * 2);
+        free(node_hash);
+        node_hash = calloc(hash_size, sizeof(int));
+        assert(node_hash);
+        for (int i = 0; i < nr_node; i ++) node_hash_insert(i);
+    }
+    nodes[nr_node] = (struct call_node) { .parent = parent, .func = func, .self = 0 };
+    node_hash_insert(nr_node);
+    return nr_node ++;
+}
+
+static int get_child(int parent, int func) {
+    uint32_t h = node_hash_idx(parent, func);
+    for (; node_hash[h] != 0; h = (h + 1) & (hash_size - 1)) {
+        struct call_node *n = &nodes[node_hash[h] - 1];
+        if (n->parent == parent && n->func == func) return node_hash[h] - 1;
+    }
+    return new_node(parent, func);
+}
 
+static inline struct func_stat *stat_of(int func) {
+    return &func_stats[func == -1 ? nr_func : func];
+}
+
+static void ftrace_init() {
+    func_stats = calloc(nr_func + 1, sizeof(struct func_stat));
+    assert(func_stats);
+    // the root node stands for the code executed before the first call
+    call_stack[0] = (struct call_frame) { .node = new_node(-1, -1), .enter = g_nr_guest_inst, .child = 0 };
+}
+
+static void push_frame(int func) {
+    if (func_stats == NULL) ftrace_init();
     call_depth ++;
+    if (call_depth >= MAX_CALL_DEPTH) return;
+    struct call_frame *parent = &call_stack[call_depth - 1];
+    call_stack[call_depth] = (struct call_frame) {
+        .node = get_child(parent->node, func), .enter = g_nr_guest_inst, .child = 0 };
+    struct func_stat *st = stat_of(func);
+    st->calls ++;
+    st->active ++;
+}
+
+static void pop_frame() {
+    if (call_depth >= MAX_CALL_DEPTH) { call_depth --; return; }
+    struct call_frame *f = &call_stack[call_depth];
+    uint64_t inclusive = g_nr_guest_inst - f->enter;
+    uint64_t exclusive = inclusive - f->child;
+    struct call_node *n = &nodes[f->node];
+    n->self += exclusive;
+    struct func_stat *st = stat_of(n->func);
+    st->exclusive += exclusive;
+    if (-- st->active == 0) st->inclusive += inclusive;
+    call_depth --;
+    call_stack[call_depth].child += inclusive;
+}
+
+void ftrace_set_folded_file(char *file) {
+    folded_file = file;
+}
+
+void ftrace_call(paddr_t pc, paddr_t target) {
+    if (func_table == NULL) return;
+
+    int func = find_func(target);
+    push_frame(func);
     if (call_depth <= 2) return;    // ignore _trm_init and main
 
-    char *func_name = get_func_name(target, false);
     log_write("[ftrace]" FMT_PADDR ": %*scall [%s@" FMT_PADDR "]\n",
 		pc,
 		(call_depth-3)*2, "",
-		func_name,
+		get_func_name(func),
 		target
 	);
 }
 
 void ftrace_ret(paddr_t pc) {
-    if (func_list == NULL) return;
+    if (func_table == NULL) return;
+    if (call_depth == 0) return;
 
-    if (call_depth <= 2) return;
+    if (call_depth > 2) {
+        log_write("[ftrace]" FMT_PADDR ": %*sret [%s]\n",
+            pc,
+            (call_depth-3)*2, "",
+            get_func_name(find_func(pc))
+        );
+    }
 
-    char *func_name = get_func_name(pc, true);
-    log_write("[ftrace]" FMT_PADDR ": %*sret [%s]\n",
-		pc,
-		(call_depth-3)*2, "",
-		func_name
-	);
+    pop_frame();
+}
 
-    call_depth --;
-}
\ No newline at end of file
+static void dump_path(FILE *fp, int node) {
+    if (nodes[node].parent == -1) return;
+    if (nodes[nodes[node].parent].parent != -1) {
+        dump_path(fp, nodes[node].parent);
+        fputc(';', fp);
+    }
+    fputs(get_func_name(nodes[node].func), fp);
+}
+
+static int stat_cmp(const void *a, const void *b) {
+    uint64_t ea = func_stats[*(const int *)a].exclusive;
+    uint64_t eb = func_stats[*(const int *)b].exclusive;
+    return ea < eb ? 1 : (ea > eb ? -1 : 0);
+}
+
+void ftrace_report() {
+    if (func_stats == NULL) return;
+
+    // close the frames which are still on the stack
+    while (call_depth > 0) pop_frame();
+
+    int *order = malloc(sizeof(int) * (nr_func + 1));
+    assert(order);
+    for (int i = 0; i <= nr_func; i ++) order[i] = i;
+    qsort(order, nr_func + 1, sizeof(int), stat_cmp);
+    Log("%-24s %12s %16s %16s", "function", "calls", "inclusive", "exclusive");
+    for (int i = 0; i < 10 && i <= nr_func && func_stats[order[i]].exclusive > 0; i ++) {
+        struct func_stat *st = &func_stats[order[i]];
+        Log("%-24s %12" PRIu64 " %16" PRIu64 " %16" PRIu64,
+            order[i] == nr_func ? "???" : func_table[order[i]].func_name,
+            st->calls, st->inclusive, st->exclusive);
+    }
+    free(order);
+
+    if (folded_file == NULL) return;
+    FILE *fp = fopen(folded_file, "w");
+    Assert(fp, "Can not open '%s'", folded_file);
+    for (int i = 0; i < nr_node; i ++) {
+        if (nodes[i].parent == -1 || nodes[i].self == 0) continue;
+        dump_path(fp, i);
+        fprintf(fp, " %" PRIu64 "\n", nodes[i].self);
+    }
+    fclose(fp);
+    Log("Folded call stacks are written to %s", folded_file);
+}
@@ -13,6 +13,11 @@
 # See the Mulan PSL v2 for more details.
 #**************************************************************************************/
 
+SRCS-BLACKLIST-$(if $(CONFIG_TRACE_TRIGGER),,y) += src/utils/trigger.c
+SRCS-BLACKLIST-$(if $(CONFIG_PROFILER),,y) += src/utils/profiler.c
+SRCS-BLACKLIST-$(if $(CONFIG_PERF_COUNTER),,y) += src/utils/perf.c
+SRCS-BLACKLIST-$(if $(CONFIG_UARCH_SIM),,y) += src/utils/uarch.c
+
 ifeq ($(CONFIG_ITRACE)$(CONFIG_IQUEUE),)
 SRCS-BLACKLIST-y += src/utils/disasm.c
 else
@@ -31,6 +31,7 @@ void init_log(const char *log_file) {
 }
 
 bool log_enable() {
+  IFDEF(CONFIG_TRACE_TRIGGER, if (trigger_configured()) return trigger_trace_on());
   return MUXDEF(CONFIG_TRACE, (g_nr_guest_inst >= CONFIG_TRACE_START) &&
          (g_nr_guest_inst <= CONFIG_TRACE_END), false);
 }
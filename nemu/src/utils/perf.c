@@ -0,0 +1,170 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+
+/* Counters are plain increments on the hot paths. Named counters are
+ * registered on first use, and the caller caches the returned pointer,
+ * so no lookup happens afterwards.
+ */
+
+#define NR_INST_COUNTER 256
+#define NR_MAP_COUNTER  32
+#define NR_INTR_COUNTER 64 // exceptions 0-31, interrupts 32-63
+
+typedef struct {
+  const char *name;
+  uint64_t count;
+} NamedCounter;
+
+typedef struct {
+  const char *name;
+  uint64_t count[2]; // read, write
+} MapCounter;
+
+PerfStat g_perf = {};
+
+static NamedCounter inst_counters[NR_INST_COUNTER] = {};
+static int nr_inst_counter = 0;
+static MapCounter map_counters[NR_MAP_COUNTER] = {};
+static int nr_map_counter = 0;
+static uint64_t intr_counters[NR_INTR_COUNTER] = {};
+static char *json_file = NULL;
+
+extern uint64_t g_nr_guest_inst;
+
+uint64_t *perf_inst_counter(const char *name) {
+  for (int i = 0; i < nr_inst_counter; i ++) {
+    if (strcmp(inst_counters[i].name, name) == 0) return &inst_counters[i].count;
+  }
+  Assert(nr_inst_counter < NR_INST_COUNTER, "too many instruction counters");
+  inst_counters[nr_inst_counter].name = name;
+  return &inst_counters[nr_inst_counter ++].count;
+}
+
+uint64_t *perf_map_counter(const char *name) {
+  for (int i = 0; i < nr_map_counter; i ++) {
+    if (strcmp(map_counters[i].name, name) == 0) return map_counters[i].count;
+  }
+  Assert(nr_map_counter < NR_MAP_COUNTER, "too many device map counters");
+  map_counters[nr_map_counter].name = name;
+  return map_counters[nr_map_counter ++].count;
+}
+
+void perf_intr(word_t NO) {
+  bool is_intr = NO >> (sizeof(word_t) * 8 - 1);
+  g_perf.trap ++;
+  intr_counters[(is_intr ? 32 : 0) + (NO & 31)] ++;
+}
+
+static int counter_cmp(const void *a, const void *b) {
+  uint64_t ca = ((const NamedCounter *)a)->count, cb = ((const NamedCounter *)b)->count;
+  return ca < cb ? 1 : (ca > cb ? -1 : 0);
+}
+
+void perf_display() {
+  printf("instructions        %" PRIu64 "\n", g_nr_guest_inst);
+  printf("loads               %" PRIu64 "\n", g_perf.load);
+  printf("stores              %" PRIu64 "\n", g_perf.store);
+  printf("branches taken      %" PRIu64 "\n", g_perf.branch_taken);
+  printf("branches untaken    %" PRIu64 "\n", g_perf.branch_untaken);
+  printf("device_update()     %" PRIu64 " (%" PRIu64 " updates)\n", g_perf.device_update, g_perf.device_sync);
+
+  // INSTPATs cache pointers into inst_counters[], so sort a copy
+  NamedCounter sorted[NR_INST_COUNTER];
+  memcpy(sorted, inst_counters, sizeof(NamedCounter) * nr_inst_counter);
+  qsort(sorted, nr_inst_counter, sizeof(NamedCounter), counter_cmp);
+  printf("instruction mix:\n");
+  for (int i = 0; i < nr_inst_counter; i ++) {
+    printf("  %-16s %16" PRIu64 " %7.2f%%\n", sorted[i].name, sorted[i].count,
+        g_nr_guest_inst ? 100.0 * sorted[i].count / g_nr_guest_inst : 0.0);
+  }
+
+  printf("device accesses:\n");
+  printf("  %-16s %16s %16s\n", "map", "read", "write");
+  for (int i = 0; i < nr_map_counter; i ++) {
+    printf("  %-16s %16" PRIu64 " %16" PRIu64 "\n", map_counters[i].name,
+        map_counters[i].count[0], map_counters[i].count[1]);
+  }
+
+  printf("exceptions/interrupts:\n");
+  for (int i = 0; i < NR_INTR_COUNTER; i ++) {
+    if (intr_counters[i] == 0) continue;
+    printf("  %-9s %-6d %16" PRIu64 "\n", i < 32 ? "exception" : "interrupt", i & 31, intr_counters[i]);
+  }
+}
+
+void perf_set_json_file(char *file) {
+  json_file = file;
+}
+
+void perf_dump_json(uint64_t host_time) {
+  if (json_file == NULL) return;
+  FILE *fp = fopen(json_file, "w");
+  Assert(fp, "Can not open '%s'", json_file);
+
+  static const char *state_name[] = {
+    [NEMU_RUNNING] = "running", [NEMU_STOP] = "stop", [NEMU_END] = "end",
+    [NEMU_ABORT] = "abort", [NEMU_QUIT] = "quit",
+  };
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"state\": \"%s\",\n", state_name[nemu_state.state]);
+  fprintf(fp, "  \"halt_pc\": %" PRIu64 ",\n", (uint64_t)nemu_state.halt_pc);
+  fprintf(fp, "  \"halt_ret\": %" PRIu32 ",\n", nemu_state.halt_ret);
+  fprintf(fp, "  \"good_trap\": %s,\n",
+      (nemu_state.state == NEMU_END && nemu_state.halt_ret == 0) ? "true" : "false");
+  fprintf(fp, "  \"host_time_us\": %" PRIu64 ",\n", host_time);
+  fprintf(fp, "  \"instructions\": %" PRIu64 ",\n", g_nr_guest_inst);
+  fprintf(fp, "  \"frequency\": %" PRIu64 ",\n", host_time > 0 ? g_nr_guest_inst * 1000000 / host_time : 0);
+  fprintf(fp, "  \"loads\": %" PRIu64 ",\n", g_perf.load);
+  fprintf(fp, "  \"stores\": %" PRIu64 ",\n", g_perf.store);
+  fprintf(fp, "  \"branches_taken\": %" PRIu64 ",\n", g_perf.branch_taken);
+  fprintf(fp, "  \"branches_untaken\": %" PRIu64 ",\n", g_perf.branch_untaken);
+  fprintf(fp, "  \"device_update_calls\": %" PRIu64 ",\n", g_perf.device_update);
+  fprintf(fp, "  \"device_updates\": %" PRIu64 ",\n", g_perf.device_sync);
+
+  fprintf(fp, "  \"inst_mix\": {");
+  for (int i = 0; i < nr_inst_counter; i ++) {
+    fprintf(fp, "%s\n    \"%s\": %" PRIu64, i == 0 ? "" : ",", inst_counters[i].name, inst_counters[i].count);
+  }
+  fprintf(fp, "\n  },\n");
+
+  fprintf(fp, "  \"mmio\": {");
+  for (int i = 0; i < nr_map_counter; i ++) {
+    fprintf(fp, "%s\n    \"%s\": { \"read\": %" PRIu64 ", \"write\": %" PRIu64 " }", i == 0 ? "" : ",",
+        map_counters[i].name, map_counters[i].count[0], map_counters[i].count[1]);
+  }
+  fprintf(fp, "\n  },\n");
+
+  fprintf(fp, "  \"exceptions\": {");
+  bool first = true;
+  for (int i = 0; i < 32; i ++) {
+    if (intr_counters[i] == 0) continue;
+    fprintf(fp, "%s\n    \"%d\": %" PRIu64, first ? "" : ",", i, intr_counters[i]);
+    first = false;
+  }
+  fprintf(fp, "\n  },\n");
+
+  fprintf(fp, "  \"interrupts\": {");
+  first = true;
+  for (int i = 32; i < NR_INTR_COUNTER; i ++) {
+    if (intr_counters[i] == 0) continue;
+    fprintf(fp, "%s\n    \"%d\": %" PRIu64, first ? "" : ",", i - 32, intr_counters[i]);
+    first = false;
+  }
+  fprintf(fp, "\n  }\n");
+  fprintf(fp, "}\n");
+  fclose(fp);
+}
@@ -0,0 +1,183 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <sys/time.h>
+#include <signal.h>
+
+/* The profiler samples the guest every N instructions, or at the next
+ * instruction after a host SIGPROF. The execution loop only decrements
+ * a countdown, and the signal handler just sets it to 1. When sampling by
+ * host time, the countdown may also run out without a signal, and such a
+ * sample is dropped. Each sample is charged to the basic block the guest
+ * is executing, which starts at the target of the last taken control
+ * transfer.
+ */
+
+#define TOP_N 10
+
+typedef struct {
+  vaddr_t block;
+  uint64_t count;
+} Sample;
+
+volatile sig_atomic_t g_prof_countdown = SIG_ATOMIC_MAX;
+vaddr_t g_prof_block = 0;
+
+static uint64_t interval = CONFIG_PROFILER_INTERVAL;
+static uint64_t interval_us = 0;
+static Sample *hist = NULL;   // open addressing, block 0 marks an empty slot
+static uint32_t hist_size = 0, nr_block = 0;
+static uint64_t nr_sample = 0;
+static volatile sig_atomic_t prof_pending = 0;
+
+static inline uint32_t hash(vaddr_t block) {
+  return ((uint32_t)block >> 2) * 2654435761u;
+}
+
+static void hist_insert(vaddr_t block, uint64_t count) {
+  uint32_t h = hash(block) & (hist_size - 1);
+  while (hist[h].block != 0 && hist[h].block != block) h = (h + 1) & (hist_size - 1);
+  if (hist[h].block == 0) { hist[h].block = block; nr_block ++; }
+  hist[h].count += count;
+}
+
+static void hist_grow() {
+  Sample *old = hist;
+  uint32_t old_size = hist_size;
+  hist_size = (hist_size == 0 ? 4096 : hist_size * 2);
+  hist = calloc(hist_size, sizeof(Sample));
+  assert(hist);
+  nr_block = 0;
+  for (uint32_t i = 0; i < old_size; i ++) {
+    if (old[i].block != 0) hist_insert(old[i].block, old[i].count);
+  }
+  free(old);
+}
+
+void profiler_sample(vaddr_t pc) {
+  if (interval_us != 0) {
+    g_prof_countdown = SIG_ATOMIC_MAX;
+    if (!prof_pending) return;
+    prof_pending = 0;
+  } else {
+    g_prof_countdown = interval;
+  }
+  if (nr_block * 2 >= hist_size) hist_grow();
+  hist_insert(g_prof_block == 0 ? pc : g_prof_block, 1);
+  nr_sample ++;
+}
+
+static void prof_sig_handler(int signum) {
+  prof_pending = 1;
+  g_prof_countdown = 1;
+}
+
+bool profiler_set_interval(const char *spec) {
+  char *end;
+  uint64_t n = strtoull(spec, &end, 0);
+  if (n == 0) return false;
+  if (strcmp(end, "us") == 0) interval_us = n;
+  else if (*end == '\0' && n <= SIG_ATOMIC_MAX) { interval = n; interval_us = 0; }
+  else return false;
+  return true;
+}
+
+void init_profiler() {
+  if (interval_us != 0) {
+    struct sigaction s;
+    memset(&s, 0, sizeof(s));
+    s.sa_handler = prof_sig_handler;
+    s.sa_flags = SA_RESTART;
+    int ret = sigaction(SIGPROF, &s, NULL);
+    Assert(ret == 0, "Can not set signal handler");
+
+    struct itimerval it = {};
+    it.it_value.tv_sec = interval_us / 1000000;
+    it.it_value.tv_usec = interval_us % 1000000;
+    it.it_interval = it.it_value;
+    ret = setitimer(ITIMER_PROF, &it, NULL);
+    Assert(ret == 0, "Can not set timer");
+    g_prof_countdown = SIG_ATOMIC_MAX;
+    Log("Profiler: sample the guest PC every %" PRIu64 " us of host CPU time", interval_us);
+  } else {
+    g_prof_countdown = interval;
+    Log("Profiler: sample the guest PC every %" PRIu64 " instructions", interval);
+  }
+}
+
+static int sample_cmp(const void *a, const void *b) {
+  uint64_t ca = ((const Sample *)a)->count, cb = ((const Sample *)b)->count;
+  return ca < cb ? 1 : (ca > cb ? -1 : 0);
+}
+
+typedef struct {
+  const char *name;
+  uint64_t count;
+} FuncSample;
+
+static int func_sample_cmp(const void *a, const void *b) {
+  uint64_t ca = ((const FuncSample *)a)->count, cb = ((const FuncSample *)b)->count;
+  return ca < cb ? 1 : (ca > cb ? -1 : 0);
+}
+
+static int func_name_cmp(const void *a, const void *b) {
+  uintptr_t na = (uintptr_t)((const FuncSample *)a)->name, nb = (uintptr_t)((const FuncSample *)b)->name;
+  return na < nb ? -1 : (na > nb ? 1 : 0);
+}
+
+void profiler_report() {
+  if (nr_sample == 0) return;
+  const char *elf_func_name(paddr_t addr);
+
+  // compact the histogram
+  Sample *blocks = malloc(sizeof(Sample) * nr_block);
+  assert(blocks);
+  int n = 0;
+  for (uint32_t i = 0; i < hist_size; i ++) {
+    if (hist[i].block != 0) blocks[n ++] = hist[i];
+  }
+  qsort(blocks, n, sizeof(Sample), sample_cmp);
+
+  Log("Profiler: %" PRIu64 " samples, %d basic blocks", nr_sample, n);
+  Log("%-12s %-24s %12s %8s", "block", "function", "samples", "share");
+  for (int i = 0; i < n && i < TOP_N; i ++) {
+    const char *name = elf_func_name(blocks[i].block);
+    Log(FMT_WORD "   %-24s %12" PRIu64 " %7.2f%%", blocks[i].block, name ? name : "???",
+        blocks[i].count, 100.0 * blocks[i].count / nr_sample);
+  }
+
+  // merge the blocks of the same function, whose names are interned by the ELF loader
+  FuncSample *funcs = malloc(sizeof(FuncSample) * n);
+  assert(funcs);
+  for (int i = 0; i < n; i ++) {
+    const char *name = elf_func_name(blocks[i].block);
+    funcs[i] = (FuncSample) { .name = (name ? name : "???"), .count = blocks[i].count };
+  }
+  qsort(funcs, n, sizeof(FuncSample), func_name_cmp);
+  int nr_func = 0;
+  for (int i = 0; i < n; i ++) {
+    if (nr_func > 0 && funcs[nr_func - 1].name == funcs[i].name) funcs[nr_func - 1].count += funcs[i].count;
+    else funcs[nr_func ++] = funcs[i];
+  }
+  qsort(funcs, nr_func, sizeof(FuncSample), func_sample_cmp);
+  Log("%-37s %12s %8s", "function", "samples", "share");
+  for (int i = 0; i < nr_func && i < TOP_N; i ++) {
+    Log("%-37s %12" PRIu64 " %7.2f%%", funcs[i].name, funcs[i].count, 100.0 * funcs[i].count / nr_sample);
+  }
+
+  free(funcs);
+  free(blocks);
+}
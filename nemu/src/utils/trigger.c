@@ -0,0 +1,191 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+
+/* A trigger turns tracing on or off when its event happens. The syntax is
+ *   ACTION:EVENT:ARG
+ * where ACTION is `start' or `stop', and EVENT is one of
+ *   pc:ADDR      the instruction at ADDR is about to be executed
+ *   func:NAME    the function NAME (resolved with the ELF file) is entered
+ *   mmio:NAME    the device map NAME (e.g. `serial') is accessed
+ *   ecall:NO     an environment call with number NO is raised
+ *   count:N      (stop only) N instructions have been traced since the last start
+ * Each trigger fires only once. Once triggers are configured, they replace
+ * the fixed window [CONFIG_TRACE_START, CONFIG_TRACE_END].
+ */
+
+#define NR_TRIGGER 16
+
+enum { TRIG_START, TRIG_STOP };
+enum { TRIG_PC, TRIG_FUNC, TRIG_MMIO, TRIG_ECALL, TRIG_COUNT };
+
+static const char *action_name[] = { "start", "stop" };
+static const char *event_name[] = { "pc", "func", "mmio", "ecall", "count" };
+
+typedef struct {
+  int action;
+  int event;
+  word_t val;    // address for pc/func, number for ecall/count
+  char *name;    // name for func/mmio
+  bool fired;
+} Trigger;
+
+static Trigger triggers[NR_TRIGGER] = {};
+static int nr_trigger = 0;
+
+// armed flags checked on the hot paths, cleared once every trigger of the kind fired
+bool g_trigger_pc_armed = false;
+bool g_trigger_mmio_armed = false;
+bool g_trigger_ecall_armed = false;
+
+static bool trace_on = true;
+static uint64_t trace_start_inst = 0;
+static uint64_t trace_count_limit = 0; // 0 means no limit
+
+extern uint64_t g_nr_guest_inst;
+
+static void rearm() {
+  g_trigger_pc_armed = g_trigger_mmio_armed = g_trigger_ecall_armed = false;
+  for (int i = 0; i < nr_trigger; i ++) {
+    Trigger *t = &triggers[i];
+    if (t->fired) continue;
+    switch (t->event) {
+      case TRIG_PC: case TRIG_FUNC: g_trigger_pc_armed = true; break;
+      case TRIG_MMIO: g_trigger_mmio_armed = true; break;
+      case TRIG_ECALL: g_trigger_ecall_armed = true; break;
+    }
+  }
+}
+
+static void fire(Trigger *t) {
+  t->fired = true;
+  if (t->action == TRIG_START) {
+    trace_on = true;
+    trace_start_inst = g_nr_guest_inst;
+  } else {
+    trace_on = false;
+  }
+  Log("trace trigger %d (%s:%s) fired at pc = " FMT_WORD ", guest instructions = %" PRIu64,
+      (int)(t - triggers), action_name[t->action], event_name[t->event], cpu.pc, g_nr_guest_inst);
+  rearm();
+}
+
+void trigger_check_pc(vaddr_t pc) {
+  for (int i = 0; i < nr_trigger; i ++) {
+    Trigger *t = &triggers[i];
+    if (!t->fired && (t->event == TRIG_PC || t->event == TRIG_FUNC) && t->val == pc) fire(t);
+  }
+}
+
+void trigger_check_mmio(const char *name) {
+  for (int i = 0; i < nr_trigger; i ++) {
+    Trigger *t = &triggers[i];
+    if (!t->fired && t->event == TRIG_MMIO && strcmp(t->name, name) == 0) fire(t);
+  }
+}
+
+void trigger_check_ecall(word_t no) {
+  for (int i = 0; i < nr_trigger; i ++) {
+    Trigger *t = &triggers[i];
+    if (!t->fired && t->event == TRIG_ECALL && t->val == no) fire(t);
+  }
+}
+
+bool trigger_configured() {
+  return nr_trigger > 0;
+}
+
+bool trigger_trace_on() {
+  if (trace_on && trace_count_limit != 0 &&
+      g_nr_guest_inst - trace_start_inst > trace_count_limit) {
+    trace_on = false;
+  }
+  return trace_on;
+}
+
+bool trigger_add(const char *spec) {
+  if (nr_trigger >= NR_TRIGGER) {
+    printf("too many triggers\n");
+    return false;
+  }
+
+  Trigger t = {};
+  char buf[128];
+  snprintf(buf, sizeof(buf), "%s", spec);
+  char *action = strtok(buf, ":");
+  char *event = strtok(NULL, ":");
+  char *arg = strtok(NULL, "");
+  if (action == NULL || event == NULL || arg == NULL) goto bad;
+
+  for (t.action = 0; t.action < ARRLEN(action_name); t.action ++) {
+    if (strcmp(action, action_name[t.action]) == 0) break;
+  }
+  for (t.event = 0; t.event < ARRLEN(event_name); t.event ++) {
+    if (strcmp(event, event_name[t.event]) == 0) break;
+  }
+  if (t.action == ARRLEN(action_name) || t.event == ARRLEN(event_name)) goto bad;
+
+  switch (t.event) {
+    case TRIG_PC: case TRIG_ECALL: t.val = strtoull(arg, NULL, 0); break;
+    case TRIG_MMIO: t.name = strdup(arg); break;
+    case TRIG_FUNC: {
+      bool elf_lookup_func(const char *name, paddr_t *entry);
+      paddr_t entry;
+      if (!elf_lookup_func(arg, &entry)) {
+        printf("can not find function '%s' in the ELF file\n", arg);
+        return false;
+      }
+      t.val = entry;
+      t.name = strdup(arg);
+      break;
+    }
+    case TRIG_COUNT:
+      if (t.action != TRIG_STOP) goto bad;
+      trace_count_limit = strtoull(arg, NULL, 0);
+      t.val = trace_count_limit;
+      t.fired = true; // checked in trigger_trace_on()
+      break;
+  }
+
+  // tracing is suspended until the start trigger fires
+  if (t.action == TRIG_START) trace_on = false;
+
+  triggers[nr_trigger ++] = t;
+  rearm();
+  return true;
+
+bad:
+  printf("bad trigger '%s', expect ACTION:EVENT:ARG, see `help trigger'\n", spec);
+  return false;
+}
+
+void trigger_display() {
+  if (nr_trigger == 0) {
+    printf("no triggers\n");
+    return;
+  }
+  printf("%-4s%-8s%-8s%-24s%s\n", "NO", "ACTION", "EVENT", "ARG", "STATE");
+  for (int i = 0; i < nr_trigger; i ++) {
+    Trigger *t = &triggers[i];
+    char arg[64];
+    if (t->event == TRIG_MMIO) snprintf(arg, sizeof(arg), "%s", t->name);
+    else if (t->event == TRIG_FUNC) snprintf(arg, sizeof(arg), "%s@" FMT_WORD, t->name, t->val);
+    else snprintf(arg, sizeof(arg), FMT_WORD, t->val);
+    printf("%-4d%-8s%-8s%-24s%s\n", i, action_name[t->action], event_name[t->event], arg,
+        t->event == TRIG_COUNT ? "-" : (t->fired ? "fired" : "armed"));
+  }
+  printf("tracing is %s\n", trigger_trace_on() ? "on" : "off");
+}
@@ -0,0 +1,151 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <memory/paddr.h>
+
+/* A functional model of the cache hierarchy and the branch predictor. It
+ * only tracks tags, so it does not change what the guest reads or writes.
+ * The L1 caches are write-back and write-allocate with LRU replacement.
+ * Their misses and write-backs go to the optional unified L2 cache.
+ * Accesses to devices are uncached and bypass the model.
+ */
+
+#define LINE_SIZE CONFIG_UARCH_CACHE_LINE
+
+typedef struct {
+  paddr_t line;    // line address, i.e. addr / LINE_SIZE
+  uint64_t stamp;  // for LRU
+  bool valid, dirty;
+} CacheLine;
+
+typedef struct Cache {
+  const char *name;
+  int nr_set, nr_way;
+  CacheLine *lines;
+  struct Cache *next;
+  uint64_t access, miss, writeback;
+} Cache;
+
+#define CACHE_SETS(size, way) ((size) / LINE_SIZE / (way))
+#define DEF_CACHE(var, cname, size, way, nxt) \
+  static CacheLine concat(var, _lines)[CACHE_SETS(size, way) * (way)] = {}; \
+  static Cache var = { .name = cname, .nr_set = CACHE_SETS(size, way), .nr_way = way, \
+    .lines = concat(var, _lines), .next = nxt }
+
+#ifdef CONFIG_UARCH_L2
+DEF_CACHE(l2, "L2", CONFIG_UARCH_L2_SIZE, CONFIG_UARCH_L2_WAYS, NULL);
+#define L2 (&l2)
+#else
+#define L2 NULL
+#endif
+DEF_CACHE(icache, "L1I", CONFIG_UARCH_ICACHE_SIZE, CONFIG_UARCH_ICACHE_WAYS, L2);
+DEF_CACHE(dcache, "L1D", CONFIG_UARCH_DCACHE_SIZE, CONFIG_UARCH_DCACHE_WAYS, L2);
+
+static uint64_t lru_clock = 0;
+
+static void cache_access_line(Cache *c, paddr_t line, bool is_write) {
+  c->access ++;
+  CacheLine *set = &c->lines[(line % c->nr_set) * c->nr_way];
+  CacheLine *victim = &set[0];
+  for (int i = 0; i < c->nr_way; i ++) {
+    CacheLine *l = &set[i];
+    if (l->valid && l->line == line) {
+      l->stamp = ++ lru_clock;
+      l->dirty |= is_write;
+      return;
+    }
+    if (!l->valid) victim = l;
+    else if (victim->valid && l->stamp < victim->stamp) victim = l;
+  }
+
+  c->miss ++;
+  if (victim->valid && victim->dirty) {
+    c->writeback ++;
+    if (c->next) cache_access_line(c->next, victim->line, true);
+  }
+  if (c->next) cache_access_line(c->next, line, false);
+  *victim = (CacheLine) { .line = line, .stamp = ++ lru_clock, .valid = true, .dirty = is_write };
+}
+
+static inline void cache_access(Cache *c, paddr_t addr, int len, bool is_write) {
+  if (!in_pmem(addr)) return;
+  paddr_t first = addr / LINE_SIZE, last = (addr + len - 1) / LINE_SIZE;
+  cache_access_line(c, first, is_write);
+  if (unlikely(last != first)) cache_access_line(c, last, is_write);
+}
+
+void uarch_icache_access(paddr_t addr, int len) {
+  cache_access(&icache, addr, len, false);
+}
+
+void uarch_dcache_access(paddr_t addr, int len, bool is_write) {
+  cache_access(&dcache, addr, len, is_write);
+}
+
+// ----------- branch predictor -----------
+
+#define BP_SIZE (1u << CONFIG_UARCH_BP_INDEX_BITS)
+
+static uint8_t pht[BP_SIZE] = {};  // 2-bit saturating counters, >= 2 means taken
+static uint64_t nr_branch = 0, nr_mispredict = 0;
+#ifdef CONFIG_UARCH_BP_GSHARE
+static uint32_t ghr = 0;           // global history of branch outcomes
+#endif
+
+void uarch_branch(vaddr_t pc, bool taken) {
+  uint32_t idx = (uint32_t)pc >> 2;
+  IFDEF(CONFIG_UARCH_BP_GSHARE, idx ^= ghr);
+  idx &= BP_SIZE - 1;
+
+  bool predict = pht[idx] >= 2;
+  nr_branch ++;
+  if (predict != taken) nr_mispredict ++;
+
+  if (taken) { if (pht[idx] < 3) pht[idx] ++; }
+  else { if (pht[idx] > 0) pht[idx] --; }
+  IFDEF(CONFIG_UARCH_BP_GSHARE,
+      ghr = ((ghr << 1) | taken) & ((1u << CONFIG_UARCH_BP_HISTORY_BITS) - 1));
+}
+
+// ----------- report -----------
+
+extern uint64_t g_nr_guest_inst;
+
+static double mpki(uint64_t miss) {
+  return g_nr_guest_inst ? 1000.0 * miss / g_nr_guest_inst : 0.0;
+}
+
+static void cache_report(Cache *c) {
+  Log("%-4s %6d KB %2d-way %14" PRIu64 " %12" PRIu64 " %8.3f%% %9.3f %12" PRIu64,
+      c->name, c->nr_set * c->nr_way * LINE_SIZE / 1024, c->nr_way, c->access, c->miss,
+      c->access ? 100.0 * c->miss / c->access : 0.0, mpki(c->miss), c->writeback);
+}
+
+void uarch_report() {
+  Log("cache model: %d-byte lines, LRU, write-back, write-allocate", LINE_SIZE);
+  Log("%-4s %9s %6s %14s %12s %9s %9s %12s",
+      "name", "size", "assoc", "accesses", "misses", "miss rate", "MPKI", "write-backs");
+  cache_report(&icache);
+  cache_report(&dcache);
+  IFDEF(CONFIG_UARCH_L2, cache_report(&l2));
+
+  Log("branch predictor: %s, %u entries" MUXDEF(CONFIG_UARCH_BP_GSHARE, ", %d-bit history", "%s"),
+      MUXDEF(CONFIG_UARCH_BP_GSHARE, "gshare", "bimodal"), BP_SIZE,
+      MUXDEF(CONFIG_UARCH_BP_GSHARE, CONFIG_UARCH_BP_HISTORY_BITS, ""));
+  Log("branches = %" PRIu64 ", mispredictions = %" PRIu64 ", accuracy = %.3f%%, MPKI = %.3f",
+      nr_branch, nr_mispredict,
+      nr_branch ? 100.0 * (nr_branch - nr_mispredict) / nr_branch : 0.0, mpki(nr_mispredict));
+}
@@ -0,0 +1,114 @@
+#include <am.h>
+#include <klib.h>
+#include <klib-macros.h>
+#include <nemu.h>
+
+/* Draw rectangles whose coordinates are far out of the screen, and make
+ * sure that the GPU of NEMU clips them without overflow, and that the
+ * parts on the screen land on the expected pixels. Run it with
+ *   make ARCH=riscv32-nemu run
+ * The test passes if it reaches HIT GOOD TRAP.
+ */
+
+#define W 4
+#define H 4
+
+#define BLACK 0x000000
+#define GREEN 0x00ff00
+#define RED   0xff0000
+
+static uint32_t black[W * H], green[W * H], red[W * H], texels[W * H];
+static int SW, SH;
+
+static const struct { int x, y, w, h; } rects[] = {
+  { 0x7ffffff0, 0, 0x20, 1 },
+  { 0, 0x7ffffff0, 1, 0x20 },
+  { 0x7fffffff, 0x7fffffff, W, H },
+  { -0x7fffffff, 0, W, H },
+  { (int)0x80000000, (int)0x80000000, W, H },
+  { 0, 0, -1, H },
+  { 0, 0, W, (int)0x80000000 },
+};
+
+static uint32_t pixel(int x, int y) {
+  return inl(FB_ADDR + ((uintptr_t)y * SW + x) * sizeof(uint32_t)) & 0xffffff;
+}
+
+static void check(int x, int y, uint32_t color) {
+  uint32_t p = pixel(x, y);
+  panic_on(p != color, "wrong pixel");
+}
+
+static void check_corners(uint32_t color) {
+  check(0, 0, color);
+  check(SW - 1, 0, color);
+  check(0, SH - 1, color);
+  check(SW - 1, SH - 1, color);
+}
+
+static void render(struct gpu_canvas *cv) {
+  cv->sibling = AM_GPU_NULL;
+  cv->texture = (struct gpu_texturedesc) { .w = W, .h = H, .pixels = sizeof(*cv) };
+  io_write(AM_GPU_MEMCPY, 0, cv, sizeof(*cv));
+  io_write(AM_GPU_MEMCPY, sizeof(*cv), texels, sizeof(texels));
+  io_write(AM_GPU_RENDER, 0);
+  io_write(AM_GPU_FBDRAW, 0, 0, NULL, 0, 0, true);
+}
+
+int main() {
+  ioe_init();
+  AM_GPU_CONFIG_T cfg = io_read(AM_GPU_CONFIG);
+  panic_on(!cfg.present, "no GPU");
+  SW = cfg.width; SH = cfg.height;
+  for (int i = 0; i < W * H; i ++) {
+    black[i] = BLACK; green[i] = GREEN; red[i] = RED;
+    texels[i] = 0x100 + i;
+  }
+
+  // clear the corners of the screen
+  io_write(AM_GPU_FBDRAW, 0, 0, black, W, H, false);
+  io_write(AM_GPU_FBDRAW, SW - W, 0, black, W, H, false);
+  io_write(AM_GPU_FBDRAW, 0, SH - H, black, W, H, false);
+  io_write(AM_GPU_FBDRAW, SW - W, SH - H, black, W, H, false);
+  // and the pixels below the scaled texture at the end
+  io_write(AM_GPU_FBDRAW, SW - W, 2 * H, black, W, H, true);
+  check_corners(BLACK);
+
+  // nothing of these is on the screen
+  for (int i = 0; i < LENGTH(rects); i ++) {
+    printf("fbdraw (%d, %d) %d x %d\n", rects[i].x, rects[i].y, rects[i].w, rects[i].h);
+    io_write(AM_GPU_FBDRAW, rects[i].x, rects[i].y, green, rects[i].w, rects[i].h, false);
+  }
+  io_write(AM_GPU_FBDRAW, 0, 0, NULL, 0, 0, true);
+  check_corners(BLACK);
+
+  // the rectangles which overlap the screen are still drawn
+  io_write(AM_GPU_FBDRAW, -2, -2, green, W, H, false);
+  io_write(AM_GPU_FBDRAW, SW - 2, SH - 2, red, W, H, true);
+  check(0, 0, GREEN); check(1, 1, GREEN);
+  check(2, 0, BLACK); check(0, 2, BLACK);
+  check(SW - 1, SH - 1, RED); check(SW - 2, SH - 2, RED);
+  check(SW - 3, SH - 1, BLACK); check(SW - 1, SH - 3, BLACK);
+
+  if (cfg.has_accel) {
+    // a texture which is scaled to a rectangle beyond the right bottom corner
+    static struct gpu_canvas cv;
+    cv = (struct gpu_canvas) { .type = AM_GPU_TEXTURE, .w = W, .h = H,
+      .x1 = 0xfff0, .y1 = 0xfff0, .w1 = 0xffff, .h1 = 0xffff };
+    render(&cv);
+    check(0, 0, GREEN);
+    check(SW - 1, SH - 1, RED);
+
+    // a texture scaled by 2 at the right edge, only its first column shows
+    cv = (struct gpu_canvas) { .type = AM_GPU_TEXTURE, .w = W, .h = H,
+      .x1 = SW - 2, .y1 = 0, .w1 = 2 * W, .h1 = 2 * H };
+    render(&cv);
+    check(SW - 2, 0, texels[0]); check(SW - 1, 1, texels[0]);
+    check(SW - 2, 2, texels[W]);
+    check(SW - 1, 7, texels[3 * W]);
+    check(SW - 3, 0, BLACK); check(SW - 1, 8, BLACK);
+  }
+
+  printf("PASS\n");
+  return 0;
+}
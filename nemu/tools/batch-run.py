@@ -0,0 +1,165 @@
+#!/usr/bin/env python3
+#***************************************************************************************
+# Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+#
+# NEMU is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#**************************************************************************************/
+
+# Run a list of images with NEMU in batch mode on several host cores, and
+# collect the result of each image from the messages printed by statistic().
+#
+#   batch-run.py -j 8 -t 60 -n 100000000 --junit report.xml build/*-riscv32-nemu.bin
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import time
+from concurrent.futures import ThreadPoolExecutor
+from xml.sax.saxutils import escape, quoteattr
+
+ANSI = re.compile(r'\x1b\[[0-9;]*m')
+PATTERNS = {
+    'trap':      re.compile(r'nemu: (HIT GOOD TRAP|HIT BAD TRAP|ABORT) at pc = (0x[0-9a-fA-F]+)'),
+    'limit':     re.compile(r'nemu: instruction limit (\d+) is reached'),
+    'host_time': re.compile(r'host time spent = ([\d,.\']+) us'),
+    'inst':      re.compile(r'total guest instructions = ([\d,.\']+)'),
+    'freq':      re.compile(r'simulation frequency = ([\d,.\']+) inst/s'),
+}
+
+def to_int(s):
+    return int(re.sub(r'[^\d]', '', s))
+
+def parse_output(out, r):
+    out = ANSI.sub('', out)
+    m = PATTERNS['trap'].search(out)
+    if m:
+        r['status'] = {'HIT GOOD TRAP': 'pass', 'HIT BAD TRAP': 'fail', 'ABORT': 'abort'}[m.group(1)]
+        r['halt_pc'] = m.group(2)
+    if PATTERNS['limit'].search(out):
+        r['status'] = 'limit'
+    for key, field in (('inst', 'instructions'), ('host_time', 'host_time_us'), ('freq', 'frequency')):
+        m = PATTERNS[key].search(out)
+        if m and r[field] is None: r[field] = to_int(m.group(1))
+    return r
+
+def test_name(image):
+    name = os.path.basename(image)
+    for suffix in ('.bin', '.elf'):
+        if name.endswith(suffix): name = name[:-len(suffix)]
+    return name
+
+def run_one(args, image, out_dir):
+    name = test_name(image)
+    log = os.path.join(out_dir, name + '-log.txt')
+    cmd = [args.nemu, '-b', '--log=' + log,
+           '--ring=' + os.path.join(out_dir, name + '-iringbuf.bin')]
+    if args.max_inst: cmd.append('--max-inst=%d' % args.max_inst)
+    elf = os.path.splitext(image)[0] + '.elf'
+    if os.path.exists(elf) and elf != image: cmd.append('--elf=' + elf)
+    cmd += args.nemu_args.split() + [image]
+
+    start = time.time()
+    try:
+        p = subprocess.run(cmd, stdin=subprocess.DEVNULL, stdout=subprocess.PIPE,
+                           stderr=subprocess.STDOUT, timeout=args.timeout)
+        out, code, timeout = p.stdout.decode(errors='replace'), p.returncode, False
+    except subprocess.TimeoutExpired as e:
+        out, code, timeout = (e.stdout or b'').decode(errors='replace'), None, True
+    wall = time.time() - start
+
+    r = {'status': 'crash', 'halt_pc': None, 'instructions': None,
+         'host_time_us': None, 'frequency': None}
+    parse_output(out, r)
+    # stdout is lost if NEMU is killed by a signal, but the log file is flushed
+    if r['instructions'] is None and os.path.exists(log):
+        with open(log, errors='replace') as f:
+            parse_output(f.read(), r)
+    if timeout: r['status'] = 'timeout'
+    r.update({'name': name, 'image': image, 'returncode': code, 'wall_time': round(wall, 3)})
+    with open(os.path.join(out_dir, name + '-output.txt'), 'w') as f:
+        f.write(out)
+    r['output_tail'] = '\n'.join(ANSI.sub('', out).splitlines()[-20:])
+    return r
+
+def write_junit(results, file, total_time):
+    failures = sum(r['status'] != 'pass' for r in results)
+    with open(file, 'w') as f:
+        f.write('<?xml version="1.0" encoding="UTF-8"?>\n')
+        f.write('<testsuite name="nemu" tests="%d" failures="%d" time="%.3f">\n'
+                % (len(results), failures, total_time))
+        for r in results:
+            f.write('  <testcase classname="nemu" name=%s time="%.3f">\n' % (quoteattr(r['name']), r['wall_time']))
+            if r['status'] != 'pass':
+                f.write('    <failure message=%s>%s</failure>\n'
+                        % (quoteattr(r['status']), escape(r['output_tail'])))
+            f.write('    <properties>\n')
+            for key in ('instructions', 'host_time_us', 'frequency', 'halt_pc'):
+                if r[key] is not None:
+                    f.write('      <property name="%s" value="%s"/>\n' % (key, r[key]))
+            f.write('    </properties>\n')
+            f.write('  </testcase>\n')
+        f.write('</testsuite>\n')
+
+def main():
+    nemu_home = os.environ.get('NEMU_HOME', os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+    ap = argparse.ArgumentParser(description='Run images with NEMU in batch mode in parallel.')
+    ap.add_argument('images', nargs='*', help='images to run')
+    ap.add_argument('-l', '--list', help='file with one image per line')
+    ap.add_argument('-j', '--jobs', type=int, default=os.cpu_count(), help='number of parallel NEMU processes')
+    ap.add_argument('-t', '--timeout', type=float, default=60, help='timeout of each image (unit: second)')
+    ap.add_argument('-n', '--max-inst', type=int, default=0, help='instruction limit of each image')
+    ap.add_argument('--nemu', default=os.path.join(nemu_home, 'build', 'riscv32-nemu-interpreter'),
+                    help='NEMU binary')
+    ap.add_argument('--nemu-args', default='', help='extra arguments passed to NEMU')
+    ap.add_argument('-o', '--out-dir', default='build/batch', help='directory for logs and dumps')
+    ap.add_argument('--json', help='write the report in JSON to this file')
+    ap.add_argument('--junit', help='write the report in JUnit XML to this file')
+    args = ap.parse_args()
+
+    images = list(args.images)
+    if args.list:
+        with open(args.list) as f:
+            images += [l.strip() for l in f if l.strip() and not l.startswith('#')]
+    if not images:
+        ap.error('no image is given')
+    os.makedirs(args.out_dir, exist_ok=True)
+
+    start = time.time()
+    results = []
+    with ThreadPoolExecutor(max_workers=max(1, args.jobs)) as pool:
+        futures = [pool.submit(run_one, args, img, args.out_dir) for img in images]
+        for fut in futures:
+            r = fut.result()
+            results.append(r)
+            inst = '' if r['instructions'] is None else '%d inst' % r['instructions']
+            freq = '' if r['frequency'] is None else '%.2f MIPS' % (r['frequency'] / 1e6)
+            print('[%7s] %-32s %16s %12s %8.2fs' % (r['status'].upper(), r['name'], inst, freq, r['wall_time']))
+            sys.stdout.flush()
+    total_time = time.time() - start
+
+    passed = sum(r['status'] == 'pass' for r in results)
+    print('%d/%d passed in %.2fs with %d jobs' % (passed, len(results), total_time, args.jobs))
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump({'passed': passed, 'total': len(results), 'time': round(total_time, 3),
+                       'results': [{k: v for k, v in r.items() if k != 'output_tail'} for r in results]},
+                      f, indent=2)
+    if args.junit:
+        write_junit(results, args.junit, total_time)
+    return 0 if passed == len(results) else 1
+
+if __name__ == '__main__':
+    sys.exit(main())
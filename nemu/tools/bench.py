@@ -0,0 +1,200 @@
+#!/usr/bin/env python3
+#***************************************************************************************
+# Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+#
+# NEMU is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#**************************************************************************************/
+
+# Run the benchmark suite with the current NEMU build, and compare guest
+# instructions, host time, MIPS and peak RSS against a stored baseline.
+# It is driven by `make bench' and `make bench-baseline'.
+
+import argparse
+import hashlib
+import importlib.util
+import json
+import os
+import statistics
+import subprocess
+import sys
+
+NEMU_HOME = os.environ.get('NEMU_HOME', os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+AM_HOME = os.environ.get('AM_HOME', os.path.join(NEMU_HOME, '..', 'abstract-machine'))
+AM_KERNELS_HOME = os.environ.get('AM_KERNELS_HOME', os.path.join(AM_HOME, '..', 'am-kernels'))
+NANOS_HOME = os.environ.get('NANOS_HOME', os.path.join(NEMU_HOME, '..', 'nanos-lite'))
+
+# name, directory, image name, make arguments, instruction limit
+# nanos-lite does not halt by itself, so its boot is bounded by instructions
+SUITE = [
+    ('microbench', os.path.join(AM_KERNELS_HOME, 'benchmarks', 'microbench'), 'microbench', ['mainargs=train'], 0),
+    ('coremark',   os.path.join(AM_KERNELS_HOME, 'benchmarks', 'coremark'),   'coremark',   [], 0),
+    ('dhrystone',  os.path.join(AM_KERNELS_HOME, 'benchmarks', 'dhrystone'),  'dhrystone',  [], 0),
+    ('nanos-lite', NANOS_HOME, 'nanos-lite', [], 200000000),
+]
+
+def load_batch_run():
+    spec = importlib.util.spec_from_file_location('batch_run', os.path.join(NEMU_HOME, 'tools', 'batch-run.py'))
+    mod = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(mod)
+    return mod
+
+def config_hash():
+    conf = os.path.join(NEMU_HOME, 'include', 'config', 'auto.conf')
+    if not os.path.exists(conf): return None
+    with open(conf, 'rb') as f:
+        lines = [l for l in f.read().splitlines() if not l.startswith(b'#')]
+    return hashlib.sha1(b'\n'.join(lines)).hexdigest()[:12]
+
+# options of the pinned configuration which differ from auto.conf
+def pinned_config_diff(isa):
+    defconfig = os.path.join(NEMU_HOME, 'configs', '%s-bench_defconfig' % isa)
+    conf = os.path.join(NEMU_HOME, 'include', 'config', 'auto.conf')
+    if not os.path.exists(defconfig): return ['%s not found' % defconfig]
+    if not os.path.exists(conf): return ['%s not found' % conf]
+    cur = {}
+    with open(conf) as f:
+        for l in f:
+            if l.startswith('CONFIG_'):
+                k, v = l.rstrip('\n').split('=', 1)
+                cur[k] = v
+    diff = []
+    with open(defconfig) as f:
+        for l in f:
+            l = l.strip()
+            if l.startswith('# CONFIG_') and l.endswith(' is not set'):
+                k, want = l[2:-len(' is not set')], None
+            elif l.startswith('CONFIG_'):
+                k, want = l.split('=', 1)
+            else: continue
+            if cur.get(k) != want:
+                diff.append('%s=%s (pinned: %s)' % (k, cur.get(k, 'n'), 'n' if want is None else want))
+    return diff
+
+def build_image(name, path, image, make_args, arch):
+    cmd = ['make', '-s', '-C', path, 'ARCH=' + arch, 'insert-arg'] + make_args
+    print('+ building %s: %s' % (name, ' '.join(cmd)))
+    if subprocess.run(cmd).returncode != 0:
+        sys.exit('failed to build %s' % name)
+    return os.path.join(path, 'build', '%s-%s.bin' % (image, arch))
+
+def run_once(br, nemu, name, image, max_inst, out_dir):
+    log = os.path.join(out_dir, name + '-log.txt')
+    cmd = [nemu, '-b', '--log=' + log, '--ring=' + os.path.join(out_dir, name + '-iringbuf.bin')]
+    if max_inst: cmd.append('--max-inst=%d' % max_inst)
+    elf = os.path.splitext(image)[0] + '.elf'
+    if os.path.exists(elf): cmd.append('--elf=' + elf)
+    cmd.append(image)
+
+    p = subprocess.Popen(cmd, stdin=subprocess.DEVNULL, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    out = p.stdout.read().decode(errors='replace')
+    _, status, rusage = os.wait4(p.pid, 0)
+    p.returncode = os.waitstatus_to_exitcode(status)
+
+    r = {'status': 'crash', 'halt_pc': None, 'instructions': None, 'host_time_us': None, 'frequency': None}
+    br.parse_output(out, r)
+    ok = r['status'] == 'pass' or (max_inst and r['status'] == 'limit')
+    if not ok or r['host_time_us'] is None:
+        with open(os.path.join(out_dir, name + '-output.txt'), 'w') as f: f.write(out)
+        sys.exit('%s: %s, see %s' % (name, r['status'], out_dir))
+    r['peak_rss_kb'] = rusage.ru_maxrss
+    return r
+
+def run_suite(args, br):
+    results = {}
+    for name, path, image, make_args, max_inst in SUITE:
+        if args.only and name not in args.only: continue
+        img = os.path.join(path, 'build', '%s-%s.bin' % (image, args.arch))
+        if not args.no_build: img = build_image(name, path, image, make_args, args.arch)
+        runs = [run_once(br, args.nemu, name, img, max_inst, args.out_dir) for _ in range(args.repeat)]
+        host_time = statistics.median(r['host_time_us'] for r in runs)
+        inst = runs[0]['instructions']
+        results[name] = {
+            'instructions': inst,
+            'host_time_us': host_time,
+            'mips': inst / host_time if host_time > 0 else 0.0,
+            'peak_rss_kb': max(r['peak_rss_kb'] for r in runs),
+        }
+        print('%-12s %14d inst %12.0f us %8.2f MIPS %8d KB' %
+              (name, inst, host_time, results[name]['mips'], results[name]['peak_rss_kb']))
+    return {'config': config_hash(), 'repeat': args.repeat, 'results': results}
+
+def delta(new, old):
+    return 100.0 * (new - old) / old if old else 0.0
+
+# returns the number of regressions beyond the threshold
+def compare(cur, base, threshold):
+    nr_regress = 0
+    print('%-12s %-12s %14s %14s %9s' % ('benchmark', 'metric', 'baseline', 'current', 'delta'))
+    for name, r in cur['results'].items():
+        b = base['results'].get(name)
+        if b is None:
+            print('%-12s not in the baseline' % name)
+            continue
+        if r['instructions'] != b['instructions']:
+            print('%-12s guest instructions changed: %d -> %d' % (name, b['instructions'], r['instructions']))
+        # host time is only shown, since MIPS already accounts for the speed
+        d = delta(r['host_time_us'], b['host_time_us'])
+        print('%-12s %-12s %14.2f %14.2f %+8.2f%%' % (name, 'host_time_us', b['host_time_us'], r['host_time_us'], d))
+        for metric, larger_is_worse in (('mips', False), ('peak_rss_kb', True)):
+            d = delta(r[metric], b[metric])
+            worse = d > threshold if larger_is_worse else d < -threshold
+            better = d < -threshold if larger_is_worse else d > threshold
+            mark = 'REGRESSION' if worse else ('improved' if better else '')
+            nr_regress += worse
+            print(('%-12s %-12s %14.2f %14.2f %+8.2f%% %s' % (name, metric, b[metric], r[metric], d, mark)).rstrip())
+    return nr_regress
+
+def main():
+    ap = argparse.ArgumentParser(description='Run the NEMU benchmark suite and compare it against a baseline.')
+    ap.add_argument('--nemu', required=True, help='NEMU binary')
+    ap.add_argument('--arch', default='riscv32-nemu', help='ARCH of the AM images')
+    ap.add_argument('--baseline', default=os.path.join(NEMU_HOME, 'bench-baseline.json'))
+    ap.add_argument('--save-baseline', action='store_true', help='save the results as the new baseline')
+    ap.add_argument('--threshold', type=float, default=5.0, help='noise threshold (unit: percent)')
+    ap.add_argument('--repeat', type=int, default=3, help='runs of each benchmark, the median is taken')
+    ap.add_argument('--only', nargs='*', help='only run these benchmarks')
+    ap.add_argument('--no-build', action='store_true', help='use the images built before')
+    ap.add_argument('--force', action='store_true', help='run even if the configuration is not the pinned one')
+    ap.add_argument('-o', '--out-dir', default=os.path.join(NEMU_HOME, 'build', 'bench'))
+    args = ap.parse_args()
+
+    diff = pinned_config_diff(args.arch.split('-')[0])
+    if diff:
+        print('the configuration differs from configs/%s-bench_defconfig:' % args.arch.split('-')[0])
+        for d in diff: print('  ' + d)
+        if not args.force:
+            sys.exit('run `make %s-bench_defconfig\' first, or pass --force' % args.arch.split('-')[0])
+
+    os.makedirs(args.out_dir, exist_ok=True)
+    cur = run_suite(args, load_batch_run())
+    with open(os.path.join(args.out_dir, 'result.json'), 'w') as f:
+        json.dump(cur, f, indent=2)
+
+    if args.save_baseline:
+        with open(args.baseline, 'w') as f:
+            json.dump(cur, f, indent=2)
+        print('baseline saved to %s' % args.baseline)
+        return 0
+    if not os.path.exists(args.baseline):
+        print('no baseline at %s, run `make bench-baseline\' to create one' % args.baseline)
+        return 0
+    with open(args.baseline) as f:
+        base = json.load(f)
+    if cur['config'] != base.get('config') and not args.force:
+        sys.exit('the configuration differs from the baseline (%s vs %s), pass --force to compare anyway' %
+                 (cur['config'], base.get('config')))
+    nr_regress = compare(cur, base, args.threshold)
+    print('%d regression(s) beyond the %.1f%% threshold' % (nr_regress, args.threshold))
+    return 1 if nr_regress else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -125,7 +125,8 @@ int main(int argc, char *argv[]) {
     buf_start = buf;
     int length = 0;
     gen_rand_expr(&length);
-    if (length > 32) continue;
+    // the evaluator has no limit on tokens, this only keeps the generated code small
+    if (length > 1024) continue;
 
     sprintf(code_buf, code_format, buf);
 
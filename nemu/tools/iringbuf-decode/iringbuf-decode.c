@@ -0,0 +1,110 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+/* Print the instruction history dumped by NEMU when it aborts.
+ * The layout must match IRingHeader in include/cpu/iringbuf.h.
+ */
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t word_size;
+  uint32_t entry_size;
+  uint32_t state;
+  uint64_t nr_inst;
+  uint64_t nr_entry;
+  uint64_t cur_pc;
+  char isa[16];
+} IRingHeader;
+
+static const char *state_name[] = { "running", "stop", "end", "abort", "quit" };
+
+static uint64_t load_word(const uint8_t *p, int size) {
+  if (size == 4) { uint32_t w; memcpy(&w, p, 4); return w; }
+  uint64_t w; memcpy(&w, p, 8); return w;
+}
+
+static void usage(const char *prog) {
+  printf("Usage: %s [-n N] [-j] FILE\n\n", prog);
+  printf("\t-n N    only print the last N instructions\n");
+  printf("\t-j      only print the control transfers, i.e. dnpc != pc + 4\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t last = 0;
+  int only_jump = 0;
+  int o;
+  while ((o = getopt(argc, argv, "n:j")) != -1) {
+    switch (o) {
+      case 'n': last = strtoull(optarg, NULL, 0); break;
+      case 'j': only_jump = 1; break;
+      default: usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1) usage(argv[0]);
+
+  FILE *fp = fopen(argv[optind], "rb");
+  if (fp == NULL) { perror(argv[optind]); return 1; }
+
+  IRingHeader h;
+  if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, "NEMUIRB", 8) != 0) {
+    fprintf(stderr, "%s: not an instruction history dump of NEMU\n", argv[optind]);
+    return 1;
+  }
+  if (h.version != 1 || (h.word_size != 4 && h.word_size != 8) || h.entry_size < h.word_size * 2 + 4) {
+    fprintf(stderr, "%s: unsupported version %u (word size %u, entry size %u)\n",
+        argv[optind], h.version, h.word_size, h.entry_size);
+    return 1;
+  }
+
+  int wd = h.word_size * 2;
+  h.isa[sizeof(h.isa) - 1] = '\0';
+  printf("isa = %s, state = %s, instructions = %" PRIu64 ", entries = %" PRIu64 "\n",
+      h.isa, h.state < 5 ? state_name[h.state] : "?", h.nr_inst, h.nr_entry);
+
+  uint64_t skip = (last != 0 && last < h.nr_entry ? h.nr_entry - last : 0);
+  if (fseek(fp, (long)(skip * h.entry_size), SEEK_CUR) != 0) { perror("fseek"); return 1; }
+
+  // the variable-length x86 instructions do not tell their length
+  int fixed_len = strcmp(h.isa, "x86") != 0;
+  uint8_t entry[64];
+  uint64_t idx = h.nr_inst - h.nr_entry + skip;
+  for (uint64_t i = skip; i < h.nr_entry; i ++, idx ++) {
+    if (h.entry_size > sizeof(entry) || fread(entry, h.entry_size, 1, fp) != 1) {
+      fprintf(stderr, "truncated file at entry %" PRIu64 "\n", i);
+      return 1;
+    }
+    uint64_t pc = load_word(entry, h.word_size);
+    uint64_t dnpc = load_word(entry + h.word_size, h.word_size);
+    uint32_t inst;
+    memcpy(&inst, entry + h.word_size * 2, 4);
+    int jump = fixed_len && dnpc != pc + 4;
+    if (only_jump && !jump) continue;
+    printf("%12" PRIu64 "  0x%0*" PRIx64 ": %08" PRIx32, idx, wd, pc, inst);
+    if (jump) printf("  -> 0x%0*" PRIx64, wd, dnpc);
+    printf("\n");
+  }
+  printf(" --> 0x%0*" PRIx64 "\n", wd, h.cur_pc);
+  fclose(fp);
+  return 0;
+}